@@ -0,0 +1,1106 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/blocked_range.h>
+#include <Eigen/Geometry>
+
+/// Cost of testing a triangle block relative to a node traversal step, used by the SAH
+#define NORI_BVH_BLOCK_COST 1.f
+
+/// Maximum number of SAH bins per axis
+#define NORI_BVH_MAX_BINS 256
+
+/// Below this many primitives, a SAH subtree is built by a single task
+#define NORI_BVH_PARALLEL_THRESHOLD 4096
+
+/// Below this many primitives, a SAH node bins its primitives in a single task
+#define NORI_BVH_PARALLEL_BINNING 65536
+
+/// Past this depth the SAH builder falls back to median splits
+#define NORI_BVH_MAX_SAH_DEPTH 64
+
+/// Traversal stack size (median splits below NORI_BVH_MAX_SAH_DEPTH bound the depth)
+#define NORI_BVH_STACK_SIZE 128
+
+/// Traversal stack size of the wide hierarchies (up to 7 entries per level)
+#define NORI_WBVH_STACK_SIZE (NORI_BVH_STACK_SIZE * 7)
+
+NORI_NAMESPACE_BEGIN
+
+/// Node of the SAH builder: subtrees are built in parallel and stored depth-first afterwards
+struct Accel::SAHNode {
+    BoundingBox3f bbox;
+    uint32_t begin, end;
+    int axis = 0;
+    std::unique_ptr<SAHNode> child[2];
+
+    bool isLeaf() const { return !child[0]; }
+};
+
+namespace {
+    /// SAH cost of intersecting \c count triangles packed into blocks
+    inline float blockCost(uint32_t count) {
+        return NORI_BVH_BLOCK_COST * ((count + TriangleBlock::Width - 1) / TriangleBlock::Width);
+    }
+
+    /// Bounds and primitive count of one SAH bin
+    struct SAHBin {
+        BoundingBox3f bbox, centroidBox;
+        uint32_t count = 0;
+
+        void expandBy(const SAHBin &bin) {
+            bbox.expandBy(bin.bbox);
+            centroidBox.expandBy(bin.centroidBox);
+            count += bin.count;
+        }
+    };
+
+    /// Bins of the three axes, filled by a (parallel) reduction over the primitives
+    struct SAHBinning {
+        const std::vector<BoundingBox3f> &bboxes;
+        const std::vector<Point3f> &centroids;
+        const uint32_t *prims;
+        const BoundingBox3f &centroidBox;
+        int binCount;
+        /// Bins of axis 'a' start at a * binCount (kept off the stack of the recursive builder)
+        std::vector<SAHBin> bins;
+
+        SAHBinning(const std::vector<BoundingBox3f> &bboxes, const std::vector<Point3f> &centroids,
+            const uint32_t *prims, const BoundingBox3f &centroidBox, int binCount)
+            : bboxes(bboxes), centroids(centroids), prims(prims), centroidBox(centroidBox),
+              binCount(binCount), bins(3 * binCount) { }
+
+        SAHBinning(SAHBinning &other, tbb::split)
+            : bboxes(other.bboxes), centroids(other.centroids), prims(other.prims),
+              centroidBox(other.centroidBox), binCount(other.binCount), bins(3 * other.binCount) { }
+
+        SAHBin &bin(int axis, int b) { return bins[axis * binCount + b]; }
+        const SAHBin &bin(int axis, int b) const { return bins[axis * binCount + b]; }
+
+        int binIndex(const Point3f &c, int axis) const {
+            float extent = centroidBox.max[axis] - centroidBox.min[axis];
+            if (extent <= 0)
+                return 0;
+            int b = (int) (binCount * (c[axis] - centroidBox.min[axis]) / extent);
+            return std::min(std::max(b, 0), binCount - 1);
+        }
+
+        void operator()(const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                uint32_t prim = prims[i];
+                const Point3f &c = centroids[prim];
+                for (int axis = 0; axis < 3; ++axis) {
+                    SAHBin &b = bin(axis, binIndex(c, axis));
+                    b.bbox.expandBy(bboxes[prim]);
+                    b.centroidBox.expandBy(c);
+                    b.count++;
+                }
+            }
+        }
+
+        void join(const SAHBinning &other) {
+            for (size_t i = 0; i < bins.size(); ++i)
+                bins[i].expandBy(other.bins[i]);
+        }
+    };
+}
+
+Accel::Accel(const PropertyList &props) {
+    std::string builder = props.getString("bvhBuilder", "sah");
+    if (builder == "sah")
+        m_builder = EBinnedSAH;
+    else if (builder == "median")
+        m_builder = EMedian;
+    else
+        throw NoriException("Accel: unknown BVH builder \"%s\" (expected \"sah\" or \"median\")", builder);
+
+    int leafSize = props.getInteger("bvhLeafSize", NORI_TRIBLOCK_WIDTH);
+    if (leafSize < 1 || leafSize > 255)
+        throw NoriException("Accel: the leaf size must be between 1 and 255 (got %i)", leafSize);
+    m_leafSize = (uint32_t) leafSize;
+
+    int binCount = props.getInteger("bvhBins", 16);
+    if (binCount < 2 || binCount > NORI_BVH_MAX_BINS)
+        throw NoriException("Accel: the number of bins must be between 2 and %i (got %i)",
+            NORI_BVH_MAX_BINS, binCount);
+    m_binCount = (uint32_t) binCount;
+
+    m_width = props.getInteger("bvhWidth", 4);
+    if (m_width != 2 && m_width != 4 && m_width != 8)
+        throw NoriException("Accel: the BVH width must be 2, 4 or 8 (got %i)", m_width);
+}
+
+std::string Accel::getBuilderName() const {
+    if (m_builder == EMedian)
+        return tfm::format("BVH%i, median, leaf size %i", m_width, m_leafSize);
+    return tfm::format("BVH%i, binned SAH, leaf size %i, %i bins", m_width, m_leafSize, m_binCount);
+}
+
+void Accel::hashBuildParameters(CacheHash &hash) const {
+    hash.add((uint32_t) m_builder).add(m_leafSize).add(m_binCount).add(m_width);
+    hash.add((uint32_t) TriangleBlock::Width).add((uint32_t) sizeof(TriangleBlock));
+    hash.add((uint32_t) sizeof(BVHNode));
+}
+
+void Accel::save(CacheWriter &writer) const {
+    float bounds[6] = { m_bbox.min.x(), m_bbox.min.y(), m_bbox.min.z(),
+                        m_bbox.max.x(), m_bbox.max.y(), m_bbox.max.z() };
+    writer.write(bounds);
+    writer.write(m_stats);
+    writer.write(m_meshOffset);
+    writer.write(m_nodes);
+    writer.write(m_wide4);
+    writer.write(m_wide8);
+    writer.write(m_primMesh);
+    writer.write(m_primTri);
+    writer.write(m_blocks);
+}
+
+void Accel::load(CacheReader &reader) {
+    Timer timer;
+    float bounds[6];
+    reader.read(bounds);
+    m_bbox = BoundingBox3f(Point3f(bounds[0], bounds[1], bounds[2]),
+                           Point3f(bounds[3], bounds[4], bounds[5]));
+    reader.read(m_stats);
+    reader.read(m_meshOffset);
+    reader.read(m_nodes);
+    reader.read(m_wide4);
+    reader.read(m_wide8);
+    reader.read(m_primMesh);
+    reader.read(m_primTri);
+    reader.read(m_blocks);
+
+    if (m_meshOffset.size() != m_meshes.size())
+        throw NoriException("Accel: the cached hierarchy was built for other meshes");
+
+    cout << "BVH (" << getBuilderName() << "): " << m_primTri.size() << " triangles, "
+         << m_stats.nodeCount << " nodes, loaded from the cache in "
+         << timer.elapsedString() << endl;
+}
+
+void Accel::addMesh(Mesh *mesh) {
+    m_meshes.push_back(mesh);
+    m_bbox.expandBy(mesh->getBoundingBox());
+}
+
+void Accel::build() {
+    Timer timer;
+
+    /* Flatten the triangles of all the meshes */
+    m_meshOffset.clear();
+    uint32_t primCount = 0;
+    for (Mesh *mesh : m_meshes) {
+        m_meshOffset.push_back(primCount);
+        primCount += mesh->getTriangleCount();
+    }
+
+    std::vector<BoundingBox3f> bboxes(primCount);
+    std::vector<Point3f> centroids(primCount);
+    std::vector<uint32_t> prims(primCount);
+    for (uint32_t m = 0; m < m_meshes.size(); ++m) {
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_meshes[m]->getTriangleCount()),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                    uint32_t idx = m_meshOffset[m] + i;
+                    bboxes[idx] = m_meshes[m]->getBoundingBox(i);
+                    centroids[idx] = m_meshes[m]->getCentroid(i);
+                    prims[idx] = idx;
+                }
+            });
+    }
+
+    m_nodes.clear();
+    if (primCount > 0 && m_builder == EMedian) {
+        m_nodes.reserve(2 * primCount / m_leafSize + 1);
+        buildRecursive(bboxes, centroids, prims, 0, primCount);
+    } else if (primCount > 0) {
+        BoundingBox3f centroidBox;
+        for (uint32_t i = 0; i < primCount; ++i)
+            centroidBox.expandBy(centroids[i]);
+
+        std::unique_ptr<SAHNode> root(buildSAH(bboxes, centroids, prims,
+            0, primCount, m_bbox, centroidBox, 0));
+        flatten(root.get());
+    }
+
+    /* Store the primitives in leaf order */
+    m_primMesh.resize(primCount);
+    m_primTri.resize(primCount);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, primCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                uint32_t m = (uint32_t) (std::upper_bound(m_meshOffset.begin(),
+                    m_meshOffset.end(), prims[i]) - m_meshOffset.begin()) - 1;
+                m_primMesh[i] = m;
+                m_primTri[i] = prims[i] - m_meshOffset[m];
+            }
+        });
+
+    buildBlocks();
+
+    /* Collapse the binary tree into wide nodes */
+    m_wide4.clear();
+    m_wide8.clear();
+    if (m_width > 2 && !m_nodes.empty()) {
+        if (m_width == 4)
+            collapse<4>(0, m_wide4);
+        else
+            collapse<8>(0, m_wide8);
+    }
+
+    m_stats.time = timer.elapsed();
+    computeStats();
+
+    /* Only the wide nodes are traversed from now on */
+    if (m_width > 2)
+        std::vector<BVHNode>().swap(m_nodes);
+
+    cout << "BVH (" << getBuilderName() << "): " << primCount << " triangles, "
+         << m_stats.nodeCount << " nodes (" << m_stats.leafCount << " leaves), "
+         << m_blocks.size() << " triangle blocks, SAH cost "
+         << tfm::format("%.2f", m_stats.sahCost) << ", "
+         << memString(m_stats.memory) << ", built in "
+         << timeString(m_stats.time) << endl;
+}
+
+void Accel::computeStats() {
+    m_stats.nodeCount = (uint32_t) m_nodes.size();
+    m_stats.leafCount = 0;
+    m_stats.sahCost = 0;
+
+    /* Expected cost of a random ray hitting the root: one unit per node
+       visited and NORI_BVH_BLOCK_COST per triangle block tested, weighted
+       by the surface areas */
+    float rootArea = m_nodes.empty() ? 0.f : m_nodes[0].bbox.getSurfaceArea();
+    double cost = 0;
+    for (const BVHNode &node : m_nodes) {
+        if (node.isLeaf())
+            m_stats.leafCount++;
+        cost += node.bbox.getSurfaceArea() * (node.isLeaf() ?
+            NORI_BVH_BLOCK_COST * blockCount(node) : 1.0);
+    }
+    m_stats.sahCost = rootArea > 0 ? (float) (cost / rootArea) : 0.f;
+
+    m_stats.memory = m_blocks.size() * sizeof(TriangleBlock)
+        + (m_primMesh.size() + m_primTri.size()) * sizeof(uint32_t);
+
+    if (m_width == 2) {
+        m_stats.memory += m_nodes.size() * sizeof(BVHNode);
+        return;
+    }
+
+    auto wideStats = [&](const auto &wide) {
+        m_stats.nodeCount = (uint32_t) wide.size();
+        m_stats.leafCount = 0;
+        for (const auto &node : wide)
+            for (int i = 0; i < (int) (sizeof(node.child) / sizeof(uint32_t)); ++i)
+                m_stats.leafCount += ((node.valid >> i) & 1) && node.isLeaf(i);
+        m_stats.memory += wide.size() * sizeof(wide[0]);
+    };
+    if (m_width == 4)
+        wideStats(m_wide4);
+    else
+        wideStats(m_wide8);
+}
+
+template <int W>
+uint32_t Accel::collapse(uint32_t nodeIdx, std::vector<WideBVHNode<W>> &wide) const {
+    uint32_t wideIdx = (uint32_t) wide.size();
+    wide.emplace_back();
+
+    /* Pull grandchildren up into this node, opening the largest inner child first */
+    uint32_t children[W];
+    int n = 0;
+    if (m_nodes[nodeIdx].isLeaf()) {
+        children[n++] = nodeIdx;  // Tiny scene: the root is a leaf
+    } else {
+        children[n++] = nodeIdx + 1;
+        children[n++] = m_nodes[nodeIdx].offset;
+    }
+    while (n < W) {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < n; ++i) {
+            const BVHNode &child = m_nodes[children[i]];
+            if (!child.isLeaf() && child.bbox.getSurfaceArea() > bestArea) {
+                bestArea = child.bbox.getSurfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+        uint32_t opened = children[best];
+        children[best] = opened + 1;
+        children[n++] = m_nodes[opened].offset;
+    }
+
+    BoundingBox3f bounds[W];
+    for (int i = 0; i < n; ++i)
+        bounds[i] = m_nodes[children[i]].bbox;
+    wide[wideIdx].setBounds(m_nodes[nodeIdx].bbox, bounds, n);
+
+    for (int i = 0; i < W; ++i) {
+        uint32_t child = NORI_INVALID_PRIM;
+        uint8_t count = 0;
+        if (i < n && m_nodes[children[i]].isLeaf()) {
+            child = m_nodes[children[i]].offset;
+            count = (uint8_t) m_nodes[children[i]].count;
+        } else if (i < n) {
+            child = collapse<W>(children[i], wide);
+        }
+        /* 'wide' may have grown: index it again */
+        wide[wideIdx].child[i] = child;
+        wide[wideIdx].count[i] = count;
+    }
+    return wideIdx;
+}
+
+void Accel::buildBlocks() {
+    const int W = TriangleBlock::Width;
+
+    /* Leaves are visited in depth-first order, so their blocks
+       end up contiguous and in the same order as the primitives */
+    std::vector<uint32_t> leaves, firstPrim;
+    uint32_t blockTotal = 0;
+    for (uint32_t n = 0; n < m_nodes.size(); ++n) {
+        BVHNode &node = m_nodes[n];
+        if (!node.isLeaf())
+            continue;
+        leaves.push_back(n);
+        firstPrim.push_back(node.offset);
+        node.offset = blockTotal;
+        blockTotal += blockCount(node);
+    }
+
+    m_blocks.resize(blockTotal);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, leaves.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t l = range.begin(); l != range.end(); ++l) {
+                const BVHNode &node = m_nodes[leaves[l]];
+                for (uint32_t i = 0; i < node.count; i += W) {
+                    TriangleBlock &block = m_blocks[node.offset + i / W];
+                    block.clear();
+                    for (uint32_t j = 0; j < W && i + j < node.count; ++j) {
+                        uint32_t prim = firstPrim[l] + i + j;
+                        const Mesh *mesh = m_meshes[m_primMesh[prim]];
+                        const MatrixXf &V = mesh->getVertexPositions();
+                        const MatrixXu &F = mesh->getIndices();
+                        uint32_t f = m_primTri[prim];
+                        block.set((int) j, V.col(F(0, f)), V.col(F(1, f)), V.col(F(2, f)), prim);
+                    }
+                }
+            }
+        });
+}
+
+uint32_t Accel::buildRecursive(std::vector<BoundingBox3f> &bboxes,
+        std::vector<Point3f> &centroids, std::vector<uint32_t> &prims,
+        uint32_t begin, uint32_t end) {
+    uint32_t nodeIdx = (uint32_t) m_nodes.size();
+    m_nodes.emplace_back();
+
+    BoundingBox3f bbox, centroidBox;
+    for (uint32_t i = begin; i < end; ++i) {
+        bbox.expandBy(bboxes[prims[i]]);
+        centroidBox.expandBy(centroids[prims[i]]);
+    }
+    m_nodes[nodeIdx].bbox = bbox;
+
+    uint32_t count = end - begin;
+    if (count <= m_leafSize) {
+        m_nodes[nodeIdx].offset = begin;
+        m_nodes[nodeIdx].count = (uint16_t) count;
+        m_nodes[nodeIdx].axis = 0;
+        return nodeIdx;
+    }
+
+    /* Object median split along the largest axis of the centroids */
+    int axis = centroidBox.getLargestAxis();
+    uint32_t mid = begin + count / 2;
+    std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+        [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    buildRecursive(bboxes, centroids, prims, begin, mid);
+    uint32_t right = buildRecursive(bboxes, centroids, prims, mid, end);
+
+    m_nodes[nodeIdx].offset = right;
+    m_nodes[nodeIdx].count = 0;
+    m_nodes[nodeIdx].axis = (uint16_t) axis;
+    return nodeIdx;
+}
+
+Accel::SAHNode *Accel::buildSAH(const std::vector<BoundingBox3f> &bboxes,
+        const std::vector<Point3f> &centroids, std::vector<uint32_t> &prims,
+        uint32_t begin, uint32_t end, const BoundingBox3f &bbox,
+        const BoundingBox3f &centroidBox, int depth) const {
+    SAHNode *node = new SAHNode();
+    node->bbox = bbox;
+    node->begin = begin;
+    node->end = end;
+
+    uint32_t count = end - begin;
+    if (count <= 1)
+        return node;
+
+    /* Split position: 'axis' and last bin of the left child, -1 for a median split */
+    int axis = centroidBox.getLargestAxis(), split = -1;
+    uint32_t mid = begin + count / 2;
+    BoundingBox3f childBox[2], childCentroids[2];
+
+    bool degenerate = centroidBox.getExtents().maxCoeff() <= 0;
+    if (!degenerate && depth < NORI_BVH_MAX_SAH_DEPTH) {
+        SAHBinning binning(bboxes, centroids, prims.data(), centroidBox, (int) m_binCount);
+        tbb::blocked_range<uint32_t> range(begin, end);
+        if (count >= NORI_BVH_PARALLEL_BINNING)
+            tbb::parallel_reduce(range, binning);
+        else
+            binning(range);
+
+        /* Sweep the split planes of every axis: areas and counts of the right side first */
+        float bestCost = std::numeric_limits<float>::infinity();
+        float nodeArea = bbox.getSurfaceArea();
+        for (int a = 0; a < 3; ++a) {
+            if (centroidBox.max[a] <= centroidBox.min[a])
+                continue;
+            std::vector<float> rightCost(m_binCount);
+            SAHBin right;
+            for (int b = (int) m_binCount - 1; b > 0; --b) {
+                right.expandBy(binning.bin(a, b));
+                rightCost[b] = right.count ? right.bbox.getSurfaceArea() * blockCost(right.count) : 0.f;
+            }
+            SAHBin left;
+            for (int b = 0; b < (int) m_binCount - 1; ++b) {
+                left.expandBy(binning.bin(a, b));
+                if (left.count == 0 || left.count == count)
+                    continue;
+                float cost = 1.f + (left.bbox.getSurfaceArea() * blockCost(left.count) + rightCost[b + 1]) / nodeArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    axis = a;
+                    split = b;
+                }
+            }
+        }
+
+        /* Keep the primitives together if testing them all is cheaper than splitting */
+        if (count <= m_leafSize && blockCost(count) <= bestCost)
+            return node;
+
+        if (split >= 0) {
+            uint32_t *first = prims.data() + begin, *last = prims.data() + end;
+            mid = (uint32_t) (std::partition(first, last, [&](uint32_t prim) {
+                return binning.binIndex(centroids[prim], axis) <= split;
+            }) - prims.data());
+
+            SAHBin left, right;
+            for (int b = 0; b < (int) m_binCount; ++b)
+                (b <= split ? left : right).expandBy(binning.bin(axis, b));
+            childBox[0] = left.bbox; childCentroids[0] = left.centroidBox;
+            childBox[1] = right.bbox; childCentroids[1] = right.centroidBox;
+        }
+    } else if (count <= m_leafSize) {
+        return node;
+    }
+
+    if (split < 0) {
+        /* Identical centroids or a very deep tree: object median split */
+        if (!degenerate)
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        for (uint32_t i = begin; i < end; ++i) {
+            int side = i < mid ? 0 : 1;
+            childBox[side].expandBy(bboxes[prims[i]]);
+            childCentroids[side].expandBy(centroids[prims[i]]);
+        }
+    }
+    node->axis = axis;
+
+    auto buildLeft = [&] {
+        node->child[0].reset(buildSAH(bboxes, centroids, prims, begin, mid,
+            childBox[0], childCentroids[0], depth + 1));
+    };
+    auto buildRight = [&] {
+        node->child[1].reset(buildSAH(bboxes, centroids, prims, mid, end,
+            childBox[1], childCentroids[1], depth + 1));
+    };
+
+    /* The two halves are disjoint ranges of 'prims': build them in parallel */
+    if (count >= NORI_BVH_PARALLEL_THRESHOLD) {
+        tbb::parallel_invoke(buildLeft, buildRight);
+    } else {
+        buildLeft();
+        buildRight();
+    }
+    return node;
+}
+
+void Accel::flatten(const SAHNode *node) {
+    uint32_t nodeIdx = (uint32_t) m_nodes.size();
+    m_nodes.emplace_back();
+    m_nodes[nodeIdx].bbox = node->bbox;
+
+    if (node->isLeaf()) {
+        m_nodes[nodeIdx].offset = node->begin;
+        m_nodes[nodeIdx].count = (uint16_t) (node->end - node->begin);
+        m_nodes[nodeIdx].axis = 0;
+        return;
+    }
+
+    flatten(node->child[0].get());
+    uint32_t right = (uint32_t) m_nodes.size();
+    flatten(node->child[1].get());
+
+    m_nodes[nodeIdx].offset = right;
+    m_nodes[nodeIdx].count = 0;
+    m_nodes[nodeIdx].axis = (uint16_t) node->axis;
+}
+
+bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) const {
+    if (shadowRay)
+        return rayOccluded(ray_);
+
+    if (m_width > 2) {
+        Ray3f ray(ray_);
+        uint32_t prim;
+        float u, v;
+        bool found = m_width == 4 ? rayIntersectWide<4, false>(m_wide4, ray, prim, u, v)
+                                  : rayIntersectWide<8, false>(m_wide8, ray, prim, u, v);
+        if (found)
+            fillIntersection(prim, u, v, ray.maxt, its);
+        return found;
+    }
+
+    bool foundIntersection = false;  // Was an intersection found so far?
+    uint32_t prim = (uint32_t) -1;   // Primitive index of the closest intersection
+
+    Ray3f ray(ray_); /// Make a copy of the ray (we will need to update its '.maxt' value)
+
+    if (m_nodes.empty())
+        return false;
+
+    uint32_t stack[NORI_BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint32_t nodeIdx = 0;
+
+    while (true) {
+        const BVHNode &node = m_nodes[nodeIdx];
+        float nearT, farT;
+
+        if (node.bbox.rayIntersect(ray, nearT, farT)) {
+            if (!node.isLeaf()) {
+                /* Visit the child on the side the ray comes from first */
+                bool dirNeg = ray.d[node.axis] < 0;
+                stack[stackSize++] = dirNeg ? nodeIdx + 1 : node.offset;
+                nodeIdx = dirNeg ? node.offset : nodeIdx + 1;
+                continue;
+            }
+
+            uint32_t blockEnd = node.offset + blockCount(node);
+            for (uint32_t b = node.offset; b < blockEnd; ++b) {
+                /* All the triangles of the block are tested at once */
+                float u, v, t;
+                int lane = m_blocks[b].rayIntersect(ray, u, v, t);
+                if (lane < 0)
+                    continue;
+
+                ray.maxt = its.t = t;
+                its.uv = Point2f(u, v);
+                prim = m_blocks[b].prim[lane];
+                foundIntersection = true;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIdx = stack[--stackSize];
+    }
+
+    if (foundIntersection) {
+        its.mesh = m_meshes[m_primMesh[prim]];
+        finishIntersection(m_primTri[prim], its);
+    }
+
+    return foundIntersection;
+}
+
+bool Accel::rayOccluded(const Ray3f &ray_) const {
+    if (m_width > 2) {
+        Ray3f ray(ray_);
+        uint32_t prim;
+        float u, v;
+        return m_width == 4 ? rayIntersectWide<4, true>(m_wide4, ray, prim, u, v)
+                            : rayIntersectWide<8, true>(m_wide8, ray, prim, u, v);
+    }
+
+    const Ray3f &ray = ray_;
+    if (m_nodes.empty())
+        return false;
+
+    uint32_t stack[NORI_BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint32_t nodeIdx = 0;
+
+    while (true) {
+        const BVHNode &node = m_nodes[nodeIdx];
+        float nearT, farT;
+
+        if (node.bbox.rayIntersect(ray, nearT, farT)) {
+            if (!node.isLeaf()) {
+                /* Any hit will do, so there is no point in sorting the children */
+                stack[stackSize++] = node.offset;
+                nodeIdx = nodeIdx + 1;
+                continue;
+            }
+
+            uint32_t blockEnd = node.offset + blockCount(node);
+            for (uint32_t b = node.offset; b < blockEnd; ++b) {
+                float u, v, t;
+                if (m_blocks[b].rayIntersect(ray, u, v, t, true) >= 0)
+                    return true;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIdx = stack[--stackSize];
+    }
+
+    return false;
+}
+
+void Accel::fillIntersection(uint32_t prim, float u, float v, float t, Intersection &its) const {
+    its.t = t;
+    its.uv = Point2f(u, v);
+    its.mesh = m_meshes[m_primMesh[prim]];
+    finishIntersection(m_primTri[prim], its);
+}
+
+void Accel::finishIntersection(uint32_t f, Intersection &its) const {
+    /* At this point, we now know that there is an intersection,
+       and we know the triangle index of the closest such intersection.
+
+       The following computes a number of additional properties which
+       characterize the intersection (normals, texture coordinates, etc..)
+    */
+
+    /* Find the barycentric coordinates */
+    Vector3f bary;
+    bary << 1-its.uv.sum(), its.uv;
+
+    /* References to all relevant mesh buffers */
+    const Mesh *mesh   = its.mesh;
+    const MatrixXf &V  = mesh->getVertexPositions();
+    const MatrixXf &N  = mesh->getVertexNormals();
+    const MatrixXf &UV = mesh->getVertexTexCoords();
+    const MatrixXu &F  = mesh->getIndices();
+    its.triangle = f;
+
+    /* Vertex indices of the triangle */
+    uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
+
+    Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
+
+    /* Compute the intersection positon accurately
+       using barycentric coordinates */
+    its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (UV.size() > 0)
+        its.uv = bary.x() * UV.col(idx0) +
+            bary.y() * UV.col(idx1) +
+            bary.z() * UV.col(idx2);
+
+    /* Compute the geometry frame */
+    its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
+
+    if (N.size() > 0) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+
+        its.shFrame = Frame(
+            (bary.x() * N.col(idx0) +
+             bary.y() * N.col(idx1) +
+             bary.z() * N.col(idx2)).normalized());
+    } else {
+        its.shFrame = its.geoFrame;
+    }
+}
+
+template <int N>
+uint32_t Accel::intersectBox(const BoundingBox3f &bbox, const RayPacket<N> &packet,
+        const float *maxt, uint32_t active) const {
+    bool overlap[N];
+    for (int i = 0; i < N; ++i) {
+        float t0x = (bbox.min.x() - packet.ox[i]) * packet.rdx[i];
+        float t1x = (bbox.max.x() - packet.ox[i]) * packet.rdx[i];
+        float t0y = (bbox.min.y() - packet.oy[i]) * packet.rdy[i];
+        float t1y = (bbox.max.y() - packet.oy[i]) * packet.rdy[i];
+        float t0z = (bbox.min.z() - packet.oz[i]) * packet.rdz[i];
+        float t1z = (bbox.max.z() - packet.oz[i]) * packet.rdz[i];
+
+        float nearT = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)),
+                               std::max(std::min(t0z, t1z), packet.mint[i]));
+        float farT  = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)),
+                               std::min(std::max(t0z, t1z), maxt[i]));
+        overlap[i] = nearT <= farT;
+    }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < N; ++i)
+        mask |= (uint32_t) overlap[i] << i;
+    return mask & active;
+}
+
+template <int N>
+uint32_t Accel::intersectTriangle(const TriangleBlock &block, int j, const RayPacket<N> &packet,
+        const float *maxt, float *tHit, float *uHit, float *vHit) const {
+    /* Triangle data is fetched once for the whole packet */
+    const Point3f p0(block.p0x[j], block.p0y[j], block.p0z[j]);
+    const Vector3f e1(block.e1x[j], block.e1y[j], block.e1z[j]);
+    const Vector3f e2(block.e2x[j], block.e2y[j], block.e2z[j]);
+
+    bool found[N];
+    for (int i = 0; i < N; ++i) {
+        /* Moeller-Trumbore, same tests as Mesh::rayIntersect() */
+        float px = packet.dy[i] * e2.z() - packet.dz[i] * e2.y();
+        float py = packet.dz[i] * e2.x() - packet.dx[i] * e2.z();
+        float pz = packet.dx[i] * e2.y() - packet.dy[i] * e2.x();
+        float det = e1.x() * px + e1.y() * py + e1.z() * pz;
+        float invDet = 1.0f / det;
+
+        float tx = packet.ox[i] - p0.x(), ty = packet.oy[i] - p0.y(), tz = packet.oz[i] - p0.z();
+        float u = (tx * px + ty * py + tz * pz) * invDet;
+
+        float qx = ty * e1.z() - tz * e1.y();
+        float qy = tz * e1.x() - tx * e1.z();
+        float qz = tx * e1.y() - ty * e1.x();
+        float v = (packet.dx[i] * qx + packet.dy[i] * qy + packet.dz[i] * qz) * invDet;
+        float t = (e2.x() * qx + e2.y() * qy + e2.z() * qz) * invDet;
+
+        found[i] = (det <= -1e-8f || det >= 1e-8f) && u >= 0.f && u <= 1.f &&
+            v >= 0.f && u + v <= 1.f && t >= packet.mint[i] && t <= maxt[i];
+        tHit[i] = t; uHit[i] = u; vHit[i] = v;
+    }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < N; ++i)
+        mask |= (uint32_t) found[i] << i;
+    return mask;
+}
+
+template <int N>
+void Accel::rayIntersectPacket(const RayPacket<N> &packet, PacketHit<N> &hit) const {
+    hit.reset();
+    if (m_width == 4) {
+        rayIntersectPacketWide<4, N, false>(m_wide4, packet, &hit);
+        return;
+    } else if (m_width == 8) {
+        rayIntersectPacketWide<8, N, false>(m_wide8, packet, &hit);
+        return;
+    }
+    if (m_nodes.empty() || packet.active == 0)
+        return;
+
+    alignas(64) float maxt[N];
+    for (int i = 0; i < N; ++i)
+        maxt[i] = packet.maxt[i];
+
+    int firstLane = 0;
+    while (!(packet.active & (1u << firstLane)))
+        ++firstLane;
+    const float dir[3] = { packet.dx[firstLane], packet.dy[firstLane], packet.dz[firstLane] };
+
+    uint32_t stack[NORI_BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint32_t nodeIdx = 0;
+
+    while (true) {
+        const BVHNode &node = m_nodes[nodeIdx];
+        uint32_t mask = intersectBox<N>(node.bbox, packet, maxt, packet.active);
+
+        if (mask) {
+            if (!node.isLeaf()) {
+                /* Coherent packets share the traversal order of their first ray */
+                bool dirNeg = dir[node.axis] < 0;
+                stack[stackSize++] = dirNeg ? nodeIdx + 1 : node.offset;
+                nodeIdx = dirNeg ? node.offset : nodeIdx + 1;
+                continue;
+            }
+
+            for (uint32_t k = 0; k < node.count; ++k) {
+                const TriangleBlock &block = m_blocks[node.offset + k / TriangleBlock::Width];
+                const int j = (int) (k % TriangleBlock::Width);
+
+                alignas(64) float tHit[N], uHit[N], vHit[N];
+                uint32_t found = intersectTriangle<N>(block, j, packet, maxt, tHit, uHit, vHit) & mask;
+
+                for (int i = 0; i < N; ++i) {
+                    if (!(found & (1u << i)))
+                        continue;
+                    hit.prim[i] = block.prim[j];
+                    maxt[i] = hit.t[i] = tHit[i];
+                    hit.u[i] = uHit[i];
+                    hit.v[i] = vHit[i];
+                }
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIdx = stack[--stackSize];
+    }
+}
+
+template <int N>
+uint32_t Accel::rayOccludedPacket(const RayPacket<N> &packet) const {
+    if (m_width == 4)
+        return rayIntersectPacketWide<4, N, true>(m_wide4, packet, nullptr);
+    else if (m_width == 8)
+        return rayIntersectPacketWide<8, N, true>(m_wide8, packet, nullptr);
+    if (m_nodes.empty() || packet.active == 0)
+        return 0;
+
+    /* Lanes that still need an answer: they retire at their first hit */
+    uint32_t active = packet.active;
+
+    uint32_t stack[NORI_BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint32_t nodeIdx = 0;
+
+    while (true) {
+        const BVHNode &node = m_nodes[nodeIdx];
+        uint32_t mask = intersectBox<N>(node.bbox, packet, packet.maxt, active);
+
+        if (mask) {
+            if (!node.isLeaf()) {
+                stack[stackSize++] = node.offset;
+                nodeIdx = nodeIdx + 1;
+                continue;
+            }
+
+            for (uint32_t k = 0; k < node.count && mask; ++k) {
+                const TriangleBlock &block = m_blocks[node.offset + k / TriangleBlock::Width];
+                alignas(64) float tHit[N], uHit[N], vHit[N];
+                uint32_t found = intersectTriangle<N>(block, (int) (k % TriangleBlock::Width),
+                    packet, packet.maxt, tHit, uHit, vHit) & mask;
+                active &= ~found;
+                mask &= ~found;
+            }
+
+            if (active == 0)
+                break;
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIdx = stack[--stackSize];
+    }
+
+    return packet.active & ~active;
+}
+
+template <int W, bool Occlusion>
+bool Accel::rayIntersectWide(const std::vector<WideBVHNode<W>> &wide, Ray3f &ray,
+        uint32_t &prim, float &u, float &v) const {
+    if (wide.empty())
+        return false;
+
+    /* Stack entries: a node (count == 0) or a leaf, with its entry distance */
+    struct Entry { uint32_t index, count; float tnear; };
+    Entry stack[NORI_WBVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0, ray.mint };
+
+    const WideRay wideRay(ray);
+    bool foundIntersection = false;
+
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        if (entry.tnear > ray.maxt)
+            continue;
+
+        if (entry.count == 0) {
+            /* All the children are tested at once */
+            const WideBVHNode<W> &node = wide[entry.index];
+            alignas(32) float tnear[W];
+            uint32_t mask = node.intersect(wideRay, ray.maxt, tnear);
+
+            int first = stackSize;
+            for (int i = 0; i < W; ++i) {
+                if (mask & (1u << i))
+                    stack[stackSize++] = { node.child[i], node.count[i], tnear[i] };
+            }
+
+            /* Closest hits: pop the nearest child first */
+            if (!Occlusion) {
+                for (int i = first + 1; i < stackSize; ++i) {
+                    Entry e = stack[i];
+                    int j = i;
+                    for (; j > first && stack[j - 1].tnear < e.tnear; --j)
+                        stack[j] = stack[j - 1];
+                    stack[j] = e;
+                }
+            }
+            continue;
+        }
+
+        uint32_t blockEnd = entry.index + (entry.count + TriangleBlock::Width - 1) / TriangleBlock::Width;
+        for (uint32_t b = entry.index; b < blockEnd; ++b) {
+            float bu, bv, t;
+            int lane = m_blocks[b].rayIntersect(ray, bu, bv, t, Occlusion);
+            if (lane < 0)
+                continue;
+            if (Occlusion)
+                return true;
+            ray.maxt = t;
+            u = bu;
+            v = bv;
+            prim = m_blocks[b].prim[lane];
+            foundIntersection = true;
+        }
+    }
+
+    return foundIntersection;
+}
+
+template <int W, int N, bool Occlusion>
+uint32_t Accel::rayIntersectPacketWide(const std::vector<WideBVHNode<W>> &wide,
+        const RayPacket<N> &packet, PacketHit<N> *hit) const {
+    if (wide.empty() || packet.active == 0)
+        return 0;
+
+    alignas(64) float maxt[N];
+    for (int i = 0; i < N; ++i)
+        maxt[i] = packet.maxt[i];
+
+    /* Lanes that still need an answer (occlusion lanes retire at their first hit) */
+    uint32_t active = packet.active, found = 0;
+
+    /* Stack entries: a node (count == 0) or a leaf, with the lanes that reach it */
+    struct Entry { uint32_t index, count, mask; };
+    Entry stack[NORI_WBVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0, active };
+
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        uint32_t mask = entry.mask & active;
+        if (!mask)
+            continue;
+
+        if (entry.count == 0) {
+            const WideBVHNode<W> &node = wide[entry.index];
+            for (int i = W - 1; i >= 0; --i) {
+                if (!(node.valid & (1u << i)))
+                    continue;
+                uint32_t childMask = intersectBox<N>(node.getChildBounds(i), packet, maxt, mask);
+                if (childMask)
+                    stack[stackSize++] = { node.child[i], node.count[i], childMask };
+            }
+            continue;
+        }
+
+        for (uint32_t k = 0; k < entry.count && mask; ++k) {
+            const TriangleBlock &block = m_blocks[entry.index + k / TriangleBlock::Width];
+            const int j = (int) (k % TriangleBlock::Width);
+
+            alignas(64) float tHit[N], uHit[N], vHit[N];
+            uint32_t laneHits = intersectTriangle<N>(block, j, packet, maxt, tHit, uHit, vHit) & mask;
+            found |= laneHits;
+
+            if (Occlusion) {
+                active &= ~laneHits;
+                mask &= ~laneHits;
+                continue;
+            }
+            for (int i = 0; i < N; ++i) {
+                if (!(laneHits & (1u << i)))
+                    continue;
+                hit->prim[i] = block.prim[j];
+                maxt[i] = hit->t[i] = tHit[i];
+                hit->u[i] = uHit[i];
+                hit->v[i] = vHit[i];
+            }
+        }
+
+        if (active == 0)
+            break;
+    }
+
+    return found;
+}
+
+void Accel::rayIntersectStream(const RayQueue &rays, HitQueue &hits) const {
+    const int N = NORI_PACKET_SIZE;
+    RayPacket<N> packet;
+    PacketHit<N> packetHit;
+
+    hits.resize(rays.size());
+    for (size_t begin = 0; begin < rays.size(); begin += N) {
+        int count = (int) std::min(rays.size() - begin, (size_t) N);
+        packet.active = 0;
+        for (int i = 0; i < count; ++i)
+            packet.set(i, rays, begin + i);
+
+        rayIntersectPacket<N>(packet, packetHit);
+
+        for (int i = 0; i < count; ++i) {
+            hits.prim[begin + i] = packetHit.prim[i];
+            if (!packetHit.hit(i))
+                continue;
+            hits.t[begin + i] = packetHit.t[i];
+            hits.u[begin + i] = packetHit.u[i];
+            hits.v[begin + i] = packetHit.v[i];
+        }
+    }
+}
+
+void Accel::rayOccludedStream(const RayQueue &rays, std::vector<uint8_t> &occluded) const {
+    const int N = NORI_PACKET_SIZE;
+    RayPacket<N> packet;
+
+    occluded.resize(rays.size());
+    for (size_t begin = 0; begin < rays.size(); begin += N) {
+        int count = (int) std::min(rays.size() - begin, (size_t) N);
+        packet.active = 0;
+        for (int i = 0; i < count; ++i)
+            packet.set(i, rays, begin + i);
+
+        uint32_t mask = rayOccludedPacket<N>(packet);
+        for (int i = 0; i < count; ++i)
+            occluded[begin + i] = (uint8_t) ((mask >> i) & 1);
+    }
+}
+
+template void Accel::rayIntersectPacket<4>(const RayPacket<4> &, PacketHit<4> &) const;
+template void Accel::rayIntersectPacket<8>(const RayPacket<8> &, PacketHit<8> &) const;
+template void Accel::rayIntersectPacket<16>(const RayPacket<16> &, PacketHit<16> &) const;
+template uint32_t Accel::rayOccludedPacket<4>(const RayPacket<4> &) const;
+template uint32_t Accel::rayOccludedPacket<8>(const RayPacket<8> &) const;
+template uint32_t Accel::rayOccludedPacket<16>(const RayPacket<16> &) const;
+
+NORI_NAMESPACE_END
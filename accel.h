@@ -0,0 +1,270 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <nori/packet.h>
+#include <nori/triblock.h>
+#include <nori/wbvh.h>
+#include <nori/cache.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Acceleration data structure for ray intersection queries
+ *
+ * Bounding volume hierarchy over the triangles of all the meshes of the
+ * scene. Besides single rays it answers queries for fixed-size packets of
+ * rays and for streams of rays, which share the node fetches of the
+ * traversal between coherent rays.
+ */
+class Accel {
+public:
+    /// Hierarchy construction algorithms
+    enum EBuilder {
+        /// Object median split along the largest axis (single-threaded)
+        EMedian = 0,
+        /// Binned surface area heuristic, subtrees built in parallel
+        EBinnedSAH
+    };
+
+    /// Statistics of the last call to \ref build()
+    struct BuildStats {
+        double time = 0;        ///< Build time in milliseconds
+        uint32_t nodeCount = 0; ///< Inner nodes and leaves (wide nodes for a BVH4/BVH8)
+        uint32_t leafCount = 0; ///< Leaves only
+        float sahCost = 0;      ///< Traversal + intersection cost of the binary tree, relative to the root box
+        size_t memory = 0;      ///< Nodes, triangle blocks and primitive tables (bytes)
+    };
+
+    /**
+     * \brief Create an empty acceleration data structure
+     *
+     * Recognized properties (all optional):
+     *  - \c bvhBuilder: \c "sah" (default) or \c "median"
+     *  - \c bvhLeafSize: maximum number of triangles in a leaf
+     *    (default: one triangle block)
+     *  - \c bvhBins: number of bins per axis of the SAH builder (default 16)
+     *  - \c bvhWidth: branching factor of the traversed hierarchy, 2, 4
+     *    (default) or 8. Wider trees are collapsed from the binary one into
+     *    nodes with compressed child bounds (\ref WideBVHNode)
+     */
+    Accel(const PropertyList &props = PropertyList());
+
+    /**
+     * \brief Register a triangle mesh for inclusion in the acceleration
+     * data structure
+     *
+     * This function can only be used before \ref build() is called
+     */
+    void addMesh(Mesh *mesh);
+
+    /// Build the acceleration data structure
+    void build();
+
+    /// Return an axis-aligned box that bounds the scene
+    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    /// Return the statistics of the last build
+    const BuildStats &getBuildStats() const { return m_stats; }
+
+    /// Return a short description of the build settings
+    std::string getBuilderName() const;
+
+    /// Add the build settings (and the layout of the cached structures) to a cache key
+    void hashBuildParameters(CacheHash &hash) const;
+
+    /// Write the finished hierarchy and its triangle data to a scene cache
+    void save(CacheWriter &writer) const;
+
+    /**
+     * \brief Restore the hierarchy from a scene cache instead of calling \ref build()
+     *
+     * The meshes must have been registered with \ref addMesh() as for a
+     * build, and the cache key must cover their contents and \ref
+     * hashBuildParameters().
+     */
+    void load(CacheReader &reader);
+
+    /**
+     * \brief Intersect a ray against all triangles stored in the scene and
+     * return detailed intersection information
+     *
+     * \param ray
+     *    A 3-dimensional ray data structure with minimum/maximum extent
+     *    information
+     *
+     * \param its
+     *    A detailed intersection record, which will be filled by the
+     *    intersection query
+     *
+     * \param shadowRay
+     *    \c true if this is a shadow ray query, i.e. a query that only aims to
+     *    find out whether the ray is blocked or not without returning detailed
+     *    intersection information.
+     *
+     * \return \c true if an intersection was found
+     */
+    bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
+
+    /**
+     * \brief Determine whether a ray segment is blocked (any-hit query)
+     *
+     * Dedicated traversal for shadow rays: it never shrinks the ray, visits
+     * the children in storage order, accepts the first triangle hit of a
+     * leaf and returns at once. No intersection record is touched.
+     */
+    bool rayOccluded(const Ray3f &ray) const;
+
+    /**
+     * \brief Intersect a packet of rays against all triangles of the scene
+     *
+     * The whole packet walks the hierarchy together: each node is fetched
+     * once and tested against all the active lanes at the same time, and a
+     * subtree is skipped only when no lane overlaps it.
+     *
+     * \param packet
+     *    Rays to intersect. Only the lanes set in \c packet.active are used
+     *
+     * \param hit
+     *    Receives the closest hit of each lane
+     */
+    template <int N>
+    void rayIntersectPacket(const RayPacket<N> &packet, PacketHit<N> &hit) const;
+
+    /**
+     * \brief Any-hit query for a packet of rays
+     *
+     * Each lane retires at its first hit, and the traversal ends as soon as
+     * every lane is blocked.
+     *
+     * \return Mask of the active lanes that are blocked
+     */
+    template <int N>
+    uint32_t rayOccludedPacket(const RayPacket<N> &packet) const;
+
+    /**
+     * \brief Intersect a stream of rays against all triangles of the scene
+     *
+     * The stream is cut into packets of \c NORI_PACKET_SIZE consecutive
+     * rays, so rays that are close to each other in the stream should also
+     * be coherent (e.g. neighboring pixels).
+     */
+    void rayIntersectStream(const RayQueue &rays, HitQueue &hits) const;
+
+    /// Any-hit query for a stream of rays: \c occluded[i] is set when ray \c i is blocked
+    void rayOccludedStream(const RayQueue &rays, std::vector<uint8_t> &occluded) const;
+
+    /**
+     * \brief Compute the detailed intersection record of a packet or stream hit
+     *
+     * \param prim
+     *    Primitive reported by the packet or stream query
+     * \param u, v, t
+     *    Barycentric coordinates and distance reported by the query
+     */
+    void fillIntersection(uint32_t prim, float u, float v, float t, Intersection &its) const;
+
+private:
+    /// BVH node: 32 bytes, children of inner nodes are stored depth-first
+    struct BVHNode {
+        BoundingBox3f bbox;
+        /// Inner node: index of the second child. Leaf: first triangle block
+        uint32_t offset;
+        /// Number of primitives (0 for inner nodes)
+        uint16_t count;
+        /// Split axis of inner nodes
+        uint16_t axis;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    /// Number of triangle blocks referenced by a leaf
+    static uint32_t blockCount(const BVHNode &node) {
+        return (node.count + TriangleBlock::Width - 1) / TriangleBlock::Width;
+    }
+
+    /// Pack the triangles of every leaf into \ref TriangleBlock records
+    void buildBlocks();
+
+    /// Collapse the binary subtree rooted at inner node \c nodeIdx into wide nodes
+    template <int W>
+    uint32_t collapse(uint32_t nodeIdx, std::vector<WideBVHNode<W>> &wide) const;
+
+    /// Closest-hit or any-hit traversal of a wide hierarchy (updates \c ray.maxt)
+    template <int W, bool Occlusion>
+    bool rayIntersectWide(const std::vector<WideBVHNode<W>> &wide, Ray3f &ray,
+        uint32_t &prim, float &u, float &v) const;
+
+    /// Packet traversal of a wide hierarchy, returns the lanes that hit something
+    template <int W, int N, bool Occlusion>
+    uint32_t rayIntersectPacketWide(const std::vector<WideBVHNode<W>> &wide,
+        const RayPacket<N> &packet, PacketHit<N> *hit) const;
+
+    /// Compute position, uv and frames of a hit whose t, uv and mesh are set
+    void finishIntersection(uint32_t f, Intersection &its) const;
+
+    /// Temporary node of the parallel SAH builder (see accel.cpp)
+    struct SAHNode;
+
+    /// Recursively build the subtree over primitives [begin, end) (median split)
+    uint32_t buildRecursive(std::vector<BoundingBox3f> &bboxes,
+        std::vector<Point3f> &centroids, std::vector<uint32_t> &prims,
+        uint32_t begin, uint32_t end);
+
+    /// Recursively build the subtree over primitives [begin, end) (binned SAH)
+    SAHNode *buildSAH(const std::vector<BoundingBox3f> &bboxes,
+        const std::vector<Point3f> &centroids, std::vector<uint32_t> &prims,
+        uint32_t begin, uint32_t end, const BoundingBox3f &bbox,
+        const BoundingBox3f &centroidBox, int depth) const;
+
+    /// Store a subtree of the SAH builder depth-first in \c m_nodes
+    void flatten(const SAHNode *node);
+
+    /// Fill in the node count, leaf count, SAH cost and memory of \c m_stats
+    void computeStats();
+
+    /// Test all lanes of a packet against triangle \c j of a block, returns a lane mask
+    template <int N>
+    uint32_t intersectTriangle(const TriangleBlock &block, int j, const RayPacket<N> &packet,
+        const float *maxt, float *t, float *u, float *v) const;
+
+    /// Test all lanes of a packet against a box, returns a lane mask
+    template <int N>
+    uint32_t intersectBox(const BoundingBox3f &bbox, const RayPacket<N> &packet,
+        const float *maxt, uint32_t active) const;
+
+private:
+    std::vector<Mesh *> m_meshes;      ///< Meshes of the scene
+    std::vector<uint32_t> m_meshOffset;///< First global triangle index of each mesh
+    std::vector<BVHNode> m_nodes;      ///< Binary hierarchy, root at index 0 (empty for a BVH4/BVH8)
+    std::vector<WideBVHNode<4>> m_wide4; ///< BVH4 hierarchy, root at index 0
+    std::vector<WideBVHNode<8>> m_wide8; ///< BVH8 hierarchy, root at index 0
+    std::vector<uint32_t> m_primMesh;  ///< Mesh of each primitive, in leaf order
+    std::vector<uint32_t> m_primTri;   ///< Triangle index of each primitive, in leaf order
+    std::vector<TriangleBlock> m_blocks; ///< Precomputed triangles, in leaf order
+    BoundingBox3f m_bbox;              ///< Bounding box of the entire scene
+    EBuilder m_builder;                ///< Construction algorithm
+    uint32_t m_leafSize;               ///< Maximum number of triangles per leaf
+    uint32_t m_binCount;               ///< SAH bins per axis
+    int m_width;                       ///< Branching factor: 2, 4 or 8
+    BuildStats m_stats;                ///< Statistics of the last build
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,258 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+/// Largest float below one: reused samples stay in [0, 1)
+#define NORI_ONE_MINUS_EPSILON 0.99999994f
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Discrete probability distribution sampled with Walker's alias method
+ *
+ * Drop-in replacement for \ref DiscretePDF with the same interface: entries
+ * are appended, \ref normalize() builds the table (Vose's construction,
+ * linear time) and the sampling functions pick an entry in constant time
+ * instead of a binary search over the CDF. This makes the cost of emitter
+ * or triangle selection independent of the number of entries, and only
+ * touches two cache lines per sample.
+ */
+struct AliasTable {
+public:
+    /// Allocate memory for a distribution with the given number of entries
+    explicit AliasTable(size_t nEntries = 0) {
+        reserve(nEntries);
+        clear();
+    }
+
+    /// Clear all entries
+    void clear() {
+        m_pdf.clear();
+        m_cells.clear();
+        m_sum = 0.0f;
+        m_normalization = 0.0f;
+        m_normalized = false;
+    }
+
+    /// Reserve memory for a certain number of entries
+    void reserve(size_t nEntries) {
+        m_pdf.reserve(nEntries);
+    }
+
+    /// Append an entry with the specified discrete probability
+    void append(float pdfValue) {
+        m_pdf.push_back(pdfValue);
+    }
+
+    /// Return the number of entries so far
+    size_t size() const {
+        return m_pdf.size();
+    }
+
+    /// Access an entry by its index (normalized once \ref normalize() was called)
+    float operator[](size_t entry) const {
+        return m_pdf.at(entry);
+    }
+
+    /// Memory used by one entry of a normalized table, in bytes
+    static size_t getEntrySize() {
+        return sizeof(float) + sizeof(Cell);
+    }
+
+    /// Have the probability densities been normalized?
+    bool isNormalized() const {
+        return m_normalized;
+    }
+
+    /**
+     * \brief Return the original (unnormalized) sum of all PDF entries
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getSum() const {
+        return m_sum;
+    }
+
+    /**
+     * \brief Return the normalization factor (i.e. the inverse of \ref getSum())
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getNormalization() const {
+        return m_normalization;
+    }
+
+    /**
+     * \brief Normalize the distribution and build the alias table
+     *
+     * \return Sum of the (previously unnormalized) entries
+     */
+    float normalize() {
+        size_t n = m_pdf.size();
+        double sum = 0.0;
+        for (float value : m_pdf)
+            sum += value;
+        m_sum = (float) sum;
+        m_cells.resize(n);
+
+        if (n == 0 || !(sum > 0)) {
+            m_normalization = 0.0f;
+            m_normalized = false;
+            return m_sum;
+        }
+
+        m_normalization = (float) (1.0 / sum);
+        m_normalized = true;
+
+        /* Scaled probabilities: the average cell holds exactly 1 */
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; ++i) {
+            m_pdf[i] = (float) (m_pdf[i] / sum);
+            scaled[i] = m_pdf[i] * (double) n;
+            (scaled[i] < 1.0 ? small : large).push_back((uint32_t) i);
+        }
+
+        /* Fill every small cell with a piece of a large one */
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            m_cells[s].prob = (float) scaled[s];
+            m_cells[s].alias = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* Leftovers are full cells (up to round-off) */
+        for (uint32_t i : large)
+            m_cells[i] = { 1.0f, i };
+        for (uint32_t i : small)
+            m_cells[i] = { 1.0f, i };
+
+        return m_sum;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue) const {
+        return sampleReuse(sampleValue);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue, float &pdf) const {
+        size_t index = sample(sampleValue);
+        pdf = m_pdf[index];
+        return index;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * The original sample is value adjusted so that it can be reused as a
+     * uniform sample on [0,1), like \ref DiscretePDF::sampleReuse().
+     *
+     * \param[in,out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue) const {
+        size_t n = m_cells.size();
+        double scaled = (double) sampleValue * (double) n;
+        size_t index = std::min((size_t) std::max(scaled, 0.0), n - 1);
+        float u = std::min((float) (scaled - (double) index), NORI_ONE_MINUS_EPSILON);
+
+        const Cell &cell = m_cells[index];
+        if (u < cell.prob) {
+            sampleValue = u / cell.prob;
+            return index;
+        }
+        sampleValue = std::min((u - cell.prob) / (1.0f - cell.prob), NORI_ONE_MINUS_EPSILON);
+        return cell.alias;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution.
+     *
+     * The original sample is value adjusted so that it can be reused as a
+     * uniform sample on [0,1), like \ref DiscretePDF::sampleReuse().
+     *
+     * \param[in,out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue, float &pdf) const {
+        size_t index = sampleReuse(sampleValue);
+        pdf = m_pdf[index];
+        return index;
+    }
+
+    /**
+     * \brief Turn the underlying distribution into a
+     * human-readable string format
+     */
+    std::string toString() const {
+        std::string result = tfm::format("AliasTable[sum=%f, "
+            "normalized=%f, pdf = {", m_sum, m_normalized);
+
+        for (size_t i = 0; i < m_pdf.size(); ++i) {
+            result += std::to_string(m_pdf[i]);
+            if (i != m_pdf.size() - 1)
+                result += ", ";
+        }
+        return result + "}]";
+    }
+
+private:
+    /// One cell of the table: keep \c index with probability \c prob, else take \c alias
+    struct Cell {
+        float prob;
+        uint32_t alias;
+    };
+
+    std::vector<float> m_pdf;
+    std::vector<Cell> m_cells;
+    float m_sum, m_normalization;
+    bool m_normalized;
+};
+
+NORI_NAMESPACE_END
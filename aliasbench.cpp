@@ -0,0 +1,100 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone microbenchmark (like warptest): compares the construction
+    and sampling cost of DiscretePDF (CDF + binary search) and AliasTable
+    (Walker's alias method) for 10 to 10M entries, and checks that the
+    alias table samples its entries with the stored probabilities.
+
+    Syntax: aliasbench [samples]
+*/
+
+#include <nori/dpdf.h>
+#include <nori/alias.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+
+using namespace nori;
+
+/// Build a distribution of \c n skewed weights, return the time in ms
+template <typename Distribution> static double build(Distribution &dist, const std::vector<float> &weights) {
+    Timer timer;
+    dist.clear();
+    dist.reserve(weights.size());
+    for (float w : weights)
+        dist.append(w);
+    dist.normalize();
+    return timer.elapsed();
+}
+
+/// Draw \c count samples with sample reuse, return the throughput in Msamples/s
+template <typename Distribution> static double sample(const Distribution &dist, size_t count,
+        std::vector<uint32_t> *histogram) {
+    pcg32 rng;
+    size_t checksum = 0;
+    Timer timer;
+    for (size_t i = 0; i < count; ++i) {
+        float s = rng.nextFloat();
+        size_t index = dist.sampleReuse(s);
+        checksum += index + (s < 0.5f);
+        if (histogram)
+            (*histogram)[index]++;
+    }
+    double ms = timer.elapsed();
+    if (checksum == 0)
+        cout << "";  // Keep the loop alive
+    return ms > 0 ? count / (ms * 1000.0) : 0.0;
+}
+
+int main(int argc, char **argv) {
+    size_t sampleCount = argc > 1 ? (size_t) std::max(toInt(argv[1]), 1) : 10000000;
+
+    cout << tfm::format("%10s  %22s  %22s  %s", "entries", "DiscretePDF", "AliasTable", "max pdf error") << endl;
+    for (size_t n = 10; n <= 10000000; n *= 10) {
+        pcg32 rng;
+        rng.seed(n);
+        std::vector<float> weights(n);
+        for (float &w : weights) {
+            float u = rng.nextFloat();
+            w = u * u * u * u;  // Skewed, like triangle areas of an adaptive mesh
+        }
+
+        DiscretePDF dpdf;
+        AliasTable alias;
+        double buildCDF = build(dpdf, weights), buildAlias = build(alias, weights);
+
+        /* Compare the sampled frequencies against the pdf on the smaller tables */
+        bool check = n <= 1000;
+        std::vector<uint32_t> histogram(check ? n : 0);
+        double rateCDF = sample(dpdf, sampleCount, nullptr);
+        double rateAlias = sample(alias, sampleCount, check ? &histogram : nullptr);
+
+        std::string error = "-";
+        if (check) {
+            float maxError = 0;
+            for (size_t i = 0; i < n; ++i)
+                maxError = std::max(maxError, std::abs(histogram[i] / (float) sampleCount - alias[i]));
+            error = tfm::format("%.2e", maxError);
+        }
+
+        cout << tfm::format("%10i  %8s %8.1f Ms/s  %8s %8.1f Ms/s  %s", n,
+            timeString(buildCDF, true), rateCDF, timeString(buildAlias, true), rateAlias, error) << endl;
+    }
+    return 0;
+}
@@ -18,20 +18,200 @@
 
 #include <nori/emitter.h>
 #include <nori/mesh.h>
+#include <nori/warp.h>
+#include <Eigen/Geometry>
+
+/// Below this solid angle (sr) spherical triangle sampling loses precision: sample the area instead
+#define NORI_MIN_SPHERICAL_TRIANGLE 3e-4f
+
+/// Above this solid angle (sr) the triangle is nearly a hemisphere: sample the area instead
+#define NORI_MAX_SPHERICAL_TRIANGLE 6.22f
 
 NORI_NAMESPACE_BEGIN
 
+namespace {
+	inline float safeSqrt(float value) {
+		return std::sqrt(std::max(value, 0.f));
+	}
+
+	inline float lerp(float t, float a, float b) {
+		return (1.f - t) * a + t * b;
+	}
+
+	/// Angle between two unit vectors, accurate for nearly (anti)parallel vectors
+	float angleBetween(const Vector3f &a, const Vector3f &b) {
+		if (a.dot(b) < 0.f)
+			return (float) M_PI - 2.f * std::asin(std::min((a + b).norm() * 0.5f, 1.f));
+		return 2.f * std::asin(std::min((b - a).norm() * 0.5f, 1.f));
+	}
+
+	/// Component of v orthogonal to the unit vector w
+	inline Vector3f gramSchmidt(const Vector3f &v, const Vector3f &w) {
+		return v - v.dot(w) * w;
+	}
+
+	/// Solid angle of the triangle (p0, p1, p2) seen from p
+	float sphericalTriangleArea(const Point3f &p0, const Point3f &p1, const Point3f &p2, const Point3f &p) {
+		Vector3f a = (p0 - p).normalized(), b = (p1 - p).normalized(), c = (p2 - p).normalized();
+		return std::abs(2.f * std::atan2(a.dot(b.cross(c)), 1.f + a.dot(b) + a.dot(c) + b.dot(c)));
+	}
+
+	/// Interior angles of the spherical triangle (a, b, c), false if degenerate
+	bool sphericalAngles(const Vector3f &a, const Vector3f &b, const Vector3f &c,
+			float &alpha, float &beta, float &gamma) {
+		Vector3f n_ab = a.cross(b), n_bc = b.cross(c), n_ca = c.cross(a);
+		if (n_ab.squaredNorm() == 0.f || n_bc.squaredNorm() == 0.f || n_ca.squaredNorm() == 0.f)
+			return false;
+		n_ab.normalize(); n_bc.normalize(); n_ca.normalize();
+		alpha = angleBetween(n_ab, -n_ca);
+		beta = angleBetween(n_bc, -n_ab);
+		gamma = angleBetween(n_ca, -n_bc);
+		return true;
+	}
+
+	/**
+	 * Uniform sampling of the spherical triangle subtended by (p0, p1, p2) at p
+	 * (Arvo 1995). Returns the barycentric coordinates of the sampled point
+	 * and its solid angle density, 0 if the triangle is degenerate.
+	 */
+	Vector3f squareToSphericalTriangle(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+			const Point3f &p, const Point2f &sample, float &pdf) {
+		pdf = 0.f;
+		Vector3f a = (p0 - p).normalized(), b = (p1 - p).normalized(), c = (p2 - p).normalized();
+		float alpha, beta, gamma;
+		if (!sphericalAngles(a, b, c, alpha, beta, gamma))
+			return Vector3f(1.f / 3.f);
+
+		/* Sub-triangle with area A' = u0 * A, which fixes the point c' on the arc ac */
+		float A_pi = alpha + beta + gamma;
+		float Ap_pi = lerp(sample.x(), (float) M_PI, A_pi);
+		float A = A_pi - (float) M_PI;
+		if (A <= 0.f)
+			return Vector3f(1.f / 3.f);
+		pdf = 1.f / A;
+
+		float cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+		float sinPhi = std::sin(Ap_pi) * cosAlpha - std::cos(Ap_pi) * sinAlpha;
+		float cosPhi = std::cos(Ap_pi) * cosAlpha + std::sin(Ap_pi) * sinAlpha;
+		float k1 = cosPhi + cosAlpha, k2 = sinPhi - sinAlpha * a.dot(b);
+		float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) / ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+		cosBp = std::min(std::max(cosBp, -1.f), 1.f);
+		float sinBp = safeSqrt(1.f - cosBp * cosBp);
+		Vector3f cp = cosBp * a + sinBp * gramSchmidt(c, a).normalized();
+
+		/* Point on the arc b c' */
+		float cosTheta = 1.f - sample.y() * (1.f - cp.dot(b));
+		float sinTheta = safeSqrt(1.f - cosTheta * cosTheta);
+		Vector3f w = cosTheta * b + sinTheta * gramSchmidt(cp, b).normalized();
+
+		/* Intersect the direction with the triangle to get barycentrics */
+		Vector3f e1 = p1 - p0, e2 = p2 - p0;
+		Vector3f s1 = w.cross(e2);
+		float divisor = s1.dot(e1);
+		if (divisor == 0.f)
+			return Vector3f(1.f / 3.f);
+		float invDivisor = 1.f / divisor;
+		Vector3f s = p - p0;
+		float b1 = std::min(std::max(s.dot(s1) * invDivisor, 0.f), 1.f);
+		float b2 = std::min(std::max(w.dot(s.cross(e1)) * invDivisor, 0.f), 1.f);
+		if (b1 + b2 > 1.f) {
+			float sum = b1 + b2;
+			b1 /= sum;
+			b2 /= sum;
+		}
+		return Vector3f(1.f - b1 - b2, b1, b2);
+	}
+
+	/// Inverse of squareToSphericalTriangle(): the sample that maps to direction w
+	Point2f sphericalTriangleToSquare(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+			const Point3f &p, const Vector3f &w) {
+		Vector3f a = (p0 - p).normalized(), b = (p1 - p).normalized(), c = (p2 - p).normalized();
+		float alpha, beta, gamma;
+		if (!sphericalAngles(a, b, c, alpha, beta, gamma))
+			return Point2f(0.5f, 0.5f);
+
+		/* c' is where the great circle through b and w crosses the arc ac */
+		Vector3f cp = (b.cross(w)).cross(c.cross(a)).normalized();
+		if (cp.dot(a + c) < 0.f)
+			cp = -cp;
+
+		float u0 = 0.f;
+		if (a.dot(cp) <= 0.99999847691f) {
+			Vector3f n_cpb = cp.cross(b), n_acp = a.cross(cp);
+			if (n_cpb.squaredNorm() == 0.f || n_acp.squaredNorm() == 0.f)
+				return Point2f(0.5f, 0.5f);
+			n_cpb.normalize();
+			n_acp.normalize();
+			Vector3f n_ab = a.cross(b).normalized();
+			float Ap = alpha + angleBetween(n_ab, n_cpb) + angleBetween(n_acp, -n_cpb) - (float) M_PI;
+			float A = alpha + beta + gamma - (float) M_PI;
+			u0 = Ap / A;
+		}
+		float u1 = (1.f - w.dot(b)) / (1.f - cp.dot(b));
+		return Point2f(std::min(std::max(u0, 0.f), 1.f), std::min(std::max(u1, 0.f), 1.f));
+	}
+
+	/// Sample x in [0,1) with density proportional to lerp(x, a, b)
+	float sampleLinear(float u, float a, float b) {
+		if (u == 0.f && a == 0.f)
+			return 0.f;
+		float x = u * (a + b) / (a + std::sqrt(lerp(u, a * a, b * b)));
+		return std::min(x, 0.99999994f);
+	}
+
+	/// Sample the unit square with density proportional to the bilinear interpolation of w
+	Point2f squareToBilinear(const Point2f &u, const float w[4]) {
+		float y = sampleLinear(u.y(), w[0] + w[1], w[2] + w[3]);
+		float x = sampleLinear(u.x(), lerp(y, w[0], w[2]), lerp(y, w[1], w[3]));
+		return Point2f(x, y);
+	}
+
+	float squareToBilinearPdf(const Point2f &p, const float w[4]) {
+		if (p.x() < 0.f || p.x() > 1.f || p.y() < 0.f || p.y() > 1.f)
+			return 0.f;
+		float sum = w[0] + w[1] + w[2] + w[3];
+		if (sum == 0.f)
+			return 1.f;
+		return 4.f * ((1.f - p.x()) * (1.f - p.y()) * w[0] + p.x() * (1.f - p.y()) * w[1] +
+			(1.f - p.x()) * p.y() * w[2] + p.x() * p.y() * w[3]) / sum;
+	}
+}
+
 class AreaEmitter : public Emitter {
 public:
+	/// Strategy used to sample a point on the chosen triangle
+	enum ESampling {
+		/// Uniform in area
+		EArea = 0,
+		/// Uniform in the solid angle subtended at the reference point
+		ESolidAngle,
+		/// Solid angle, warped towards the cosine at the reference point
+		EProjectedSolidAngle
+	};
+
 	AreaEmitter(const PropertyList &propList) : m_mesh(NULL) {
 		/* Emitted radiance */
 		m_radiance = propList.getColor("radiance");
+
+		/* Sampling strategy */
+		std::string sampling = propList.getString("sampling", "area");
+		if (sampling == "area")
+			m_sampling = EArea;
+		else if (sampling == "solidAngle")
+			m_sampling = ESolidAngle;
+		else if (sampling == "projectedSolidAngle")
+			m_sampling = EProjectedSolidAngle;
+		else
+			throw NoriException("AreaEmitter: unknown sampling strategy \"%s\"", sampling);
 	}
 
 	Color3f sample(EmitterQueryRecord &lRec, const Point2f &sample) const {
 
 		Point2f s(sample);
 
+		if (m_sampling != EArea)
+			return sampleSolidAngle(lRec, s);
+
 		// obtener un punto aleatorio en la malla asociada al emisor
 		m_mesh->samplePoint(lRec, s);
 		
@@ -60,6 +240,11 @@ public:
 
 	float pdf(const EmitterQueryRecord& lRec) const {
 		float cosTheta = lRec.n.dot(-lRec.wi);
+		if (m_sampling != EArea) {
+			float solidAnglePdf;
+			if (triangleSolidAnglePdf(lRec, solidAnglePdf))
+				return cosTheta > 0.f ? solidAnglePdf : 0.f;
+		}
 		//return (lRec.p - lRec.ref).squaredNorm() / cosTheta * lRec.pdf;
 		return m_mesh->getPDF() * (lRec.p - lRec.ref).squaredNorm() / cosTheta;
 	}
@@ -75,16 +260,143 @@ public:
 	}
 
 	std::string toString() const {
-		return tfm::format("AreaEmitter[radiance=%s]", m_radiance.toString());
+		return tfm::format("AreaEmitter[radiance=%s, sampling=%s]", m_radiance.toString(),
+			m_sampling == EArea ? "area" : (m_sampling == ESolidAngle ? "solidAngle" : "projectedSolidAngle"));
 	}
 
 	virtual float getLuminance() const {
 		return m_radiance.getLuminance();
 	}
+
+	bool hasPower() const { return true; }
+
+	virtual float computePower() {
+		return m_power = getLuminance() * m_mesh->getSurfaceArea() * (float) M_PI;
+	}
+
+	Color3f samplePhoton(Ray3f &ray, Normal3f &n, const Point2f &positionSample, const Point2f &directionSample) const {
+		/* Triangle by area, point uniform on it, direction cosine-weighted about the normal */
+		float u = positionSample.x(), pmf;
+		uint32_t index = (uint32_t) m_mesh->getSamplingTable().sampleReuse(u, pmf);
+		EmitterQueryRecord lRec(Point3f(0.0f));
+		m_mesh->sampleTriangle(index, Point2f(u, positionSample.y()), lRec);
+		if (!(pmf * lRec.pdf > 0.f))
+			return Color3f(0.0f);
+		n = lRec.n;
+		ray = Ray3f(lRec.p, Frame(lRec.n).toWorld(Warp::squareToCosineHemisphere(directionSample)));
+
+		/* Radiance x cosine over (area density x cosine / pi) */
+		return m_radiance * (float) M_PI / (pmf * lRec.pdf);
+	}
+
+	void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d, float &pdfPos, float &pdfDir) const {
+		/* Triangles by area and uniform points on them: uniform over the mesh */
+		pdfPos = m_mesh->getPDF();
+		pdfDir = std::max(n.dot(d), 0.0f) * INV_PI;
+	}
 private:
+	/// Vertices of triangle \c index of the mesh
+	void getTriangle(uint32_t index, Point3f &p0, Point3f &p1, Point3f &p2) const {
+		const MatrixXf &V = m_mesh->getVertexPositions();
+		const MatrixXu &F = m_mesh->getIndices();
+		p0 = V.col(F(0, index));
+		p1 = V.col(F(1, index));
+		p2 = V.col(F(2, index));
+	}
+
+	/// Shading normal at the barycentric coordinates \c bary of triangle \c index
+	Normal3f getNormal(uint32_t index, const Vector3f &bary) const {
+		const MatrixXf &N = m_mesh->getVertexNormals();
+		const MatrixXu &F = m_mesh->getIndices();
+		if (N.size() == 0) {
+			Point3f p0, p1, p2;
+			getTriangle(index, p0, p1, p2);
+			return (p1 - p0).cross(p2 - p0).normalized();
+		}
+		return (bary.x() * N.col(F(0, index)) + bary.y() * N.col(F(1, index)) +
+			bary.z() * N.col(F(2, index))).normalized();
+	}
+
+	/// Bilinear weights of the projected variant: cosines at the receiver towards the vertices
+	bool projectedWeights(const EmitterQueryRecord &lRec, const Point3f &p0, const Point3f &p1,
+			const Point3f &p2, float w[4]) const {
+		if (m_sampling != EProjectedSolidAngle || lRec.refN.isZero())
+			return false;
+		float c0 = std::max(0.01f, std::abs(lRec.refN.dot((p0 - lRec.ref).normalized())));
+		float c1 = std::max(0.01f, std::abs(lRec.refN.dot((p1 - lRec.ref).normalized())));
+		float c2 = std::max(0.01f, std::abs(lRec.refN.dot((p2 - lRec.ref).normalized())));
+		/* u.y = 0 is vertex b (p1), u.y = 1 the arc from a (u.x = 0) to c (u.x = 1) */
+		w[0] = c1; w[1] = c1; w[2] = c0; w[3] = c2;
+		return true;
+	}
+
+	/**
+	 * Solid angle density of lRec.p under the spherical sampling strategies,
+	 * false if its triangle is sampled by area (tiny or huge solid angle)
+	 */
+	bool triangleSolidAnglePdf(const EmitterQueryRecord &lRec, float &pdf) const {
+		Point3f p0, p1, p2;
+		getTriangle(lRec.triangle, p0, p1, p2);
+		float solidAngle = sphericalTriangleArea(p0, p1, p2, lRec.ref);
+		if (!(solidAngle >= NORI_MIN_SPHERICAL_TRIANGLE && solidAngle <= NORI_MAX_SPHERICAL_TRIANGLE))
+			return false;
+
+		pdf = m_mesh->getSamplingTable()[lRec.triangle] / solidAngle;
+		float w[4];
+		if (projectedWeights(lRec, p0, p1, p2, w))
+			pdf *= squareToBilinearPdf(sphericalTriangleToSquare(p0, p1, p2, lRec.ref, lRec.wi), w);
+		return true;
+	}
+
+	/// Triangle chosen by area, point chosen in the solid angle it subtends at lRec.ref
+	Color3f sampleSolidAngle(EmitterQueryRecord &lRec, Point2f &s) const {
+		float pmf;
+		uint32_t index = (uint32_t) m_mesh->getSamplingTable().sampleReuse(s.x(), pmf);
+		Point3f p0, p1, p2;
+		getTriangle(index, p0, p1, p2);
+
+		float solidAngle = sphericalTriangleArea(p0, p1, p2, lRec.ref);
+		if (!(solidAngle >= NORI_MIN_SPHERICAL_TRIANGLE && solidAngle <= NORI_MAX_SPHERICAL_TRIANGLE)) {
+			/* Too small or too large for a stable spherical sample: uniform in area */
+			m_mesh->sampleTriangle(index, s, lRec);
+			lRec.wi = (lRec.p - lRec.ref).normalized();
+			float cosTheta = lRec.n.dot(-lRec.wi);
+			if (cosTheta <= 0.f)
+				return Color3f(0.0f);
+			lRec.pdf *= pmf;
+			return eval(lRec) / (lRec.pdf * (lRec.p - lRec.ref).squaredNorm() / cosTheta);
+		}
+
+		float w[4], pdf = 1.f;
+		Point2f u(s);
+		if (projectedWeights(lRec, p0, p1, p2, w)) {
+			u = squareToBilinear(s, w);
+			pdf = squareToBilinearPdf(u, w);
+		}
+
+		float triPdf;
+		Vector3f bary = squareToSphericalTriangle(p0, p1, p2, lRec.ref, u, triPdf);
+		if (triPdf <= 0.f || pdf <= 0.f)
+			return Color3f(0.0f);
+		pdf *= triPdf * pmf;
+
+		lRec.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+		lRec.n = getNormal(index, bary);
+		lRec.triangle = index;
+		lRec.wi = (lRec.p - lRec.ref).normalized();
+		float cosTheta = lRec.n.dot(-lRec.wi);
+		if (cosTheta <= 0.f)
+			return Color3f(0.0f);
+
+		/* Keep lRec.pdf an area density, like the area strategy */
+		lRec.pdf = pdf * cosTheta / (lRec.p - lRec.ref).squaredNorm();
+		return eval(lRec) / pdf;
+	}
+
 	Color3f m_radiance;
 	Mesh *m_mesh;
+	ESampling m_sampling;
 };
 
 NORI_REGISTER_CLASS(AreaEmitter, "area");
-NORI_NAMESPACE_END
\ No newline at end of file
+NORI_NAMESPACE_END
@@ -0,0 +1,344 @@
+/*
+	Bidirectional path tracing
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Bidirectional path tracer (Veach, Lafortune) with MIS
+ *
+ * For every camera ray a camera subpath and a light subpath are traced,
+ * and every light subpath prefix of s vertices is connected with every
+ * camera subpath prefix of t >= 2 vertices (with s + t - 2 <= \c maxDepth
+ * bounces); s = 0 is the camera subpath hitting an emitter. The
+ * contributions are weighted with the balance heuristic over all the
+ * strategies that could have produced the same path, computed in O(s + t)
+ * from the forward and reverse area densities of its vertices as in pbrt.
+ * Light subpaths start like photons: on an emitter chosen by power
+ * (\ref Scene::sampleEmitterPower()), at the point and in the direction
+ * given by \ref Emitter::samplePhoton(), whose densities come from
+ * \ref Emitter::pdfPhoton(); s = 1 connects the camera vertex to that same
+ * starting point.
+ *
+ * Since \ref Integrator::Li() returns one value per camera ray and cannot
+ * splat into other pixels, light subpaths are not connected to the camera
+ * (t = 1, light tracing), and those strategies are left out of the MIS
+ * weights. As in the other integrators emitters do not reflect light, and
+ * subpaths end on them.
+ *
+ * The subpaths live in per-thread arrays that are sized once, so tracing
+ * them allocates nothing.
+ */
+class BDPT : public Integrator {
+    /// Vertex of a subpath
+    struct Vertex {
+        enum EType : uint8_t { ECamera, ELight, ESurface };
+
+        EType type;
+        /// Specular BSDF: cannot be connected to
+        bool delta;
+        Point3f p;
+        /// Geometric normal
+        Normal3f n;
+        Frame shFrame;
+        /// Direction towards the previous vertex of the subpath (local)
+        Vector3f wi;
+        /// Surface of a surface vertex, emitter of a light vertex or of an emitting surface
+        const Mesh *mesh;
+        const Emitter *emitter;
+        /// Throughput of the subpath up to this vertex
+        Color3f beta;
+        /// Area density of this vertex when sampled from its neighbour in the
+        /// direction of its subpath (forward) and in the opposite one (reverse)
+        float pdfFwd, pdfRev;
+
+        bool isEmitter() const { return emitter != nullptr; }
+
+        /// Solid angle density at this vertex towards \c next to area density at \c next
+        float convertDensity(float pdf, const Vertex &next) const {
+            Vector3f w = next.p - p;
+            float dist2 = w.squaredNorm();
+            if (dist2 == 0.f)
+                return 0.f;
+            if (next.type != ECamera)
+                pdf *= std::abs(next.n.dot(w / std::sqrt(dist2)));
+            return pdf / dist2;
+        }
+    };
+
+public:
+    BDPT(const PropertyList &props) {
+        m_maxDepth = std::max(props.getInteger("maxDepth", 10), 1);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        static thread_local std::vector<Vertex> cameraPath, lightPath;
+        if (cameraPath.size() < (size_t) m_maxDepth + 2) {
+            cameraPath.resize(m_maxDepth + 2);
+            lightPath.resize(m_maxDepth + 1);
+        }
+
+        /* Camera subpath; the density of its first hit is only needed for light tracing */
+        Vertex &camera = cameraPath[0];
+        camera.type = Vertex::ECamera;
+        camera.delta = false;
+        camera.p = ray.o;
+        camera.mesh = nullptr;
+        camera.emitter = nullptr;
+        camera.beta = Color3f(1.f);
+        camera.pdfFwd = camera.pdfRev = 0.f;
+        int cameraCount = randomWalk(scene, sampler, ray, Color3f(1.f), 1.f, m_maxDepth + 2, cameraPath.data());
+
+        /* Light subpath */
+        int lightCount = 0;
+        Ray3f lightRay;
+        Color3f lightBeta;
+        float pdfDir;
+        if (sampleLight(scene, sampler, lightPath[0], lightRay, lightBeta, pdfDir))
+            lightCount = randomWalk(scene, sampler, lightRay, lightBeta, pdfDir, m_maxDepth + 1, lightPath.data());
+
+        Color3f result(0.f);
+        for (int t = 2; t <= cameraCount; ++t) {
+            for (int s = 0; s <= lightCount && s + t - 2 <= m_maxDepth; ++s) {
+                Color3f L = connect(scene, lightPath.data(), cameraPath.data(), s, t);
+                if (!L.isZero())
+                    result += L * misWeight(scene, lightPath.data(), cameraPath.data(), s, t);
+            }
+        }
+        return result;
+    }
+
+    std::string toString() const {
+        return tfm::format("BDPT[maxDepth = %i]", m_maxDepth);
+    }
+
+private:
+    /**
+     * \brief Sample the first vertex of a light subpath and the ray leaving it
+     *
+     * \c beta receives the throughput of the ray, \c pdfDir its solid
+     * angle density.
+     */
+    bool sampleLight(const Scene *scene, Sampler *sampler, Vertex &v, Ray3f &ray, Color3f &beta, float &pdfDir) const {
+        float pmf;
+        const Emitter *emitter = scene->sampleEmitterPower(sampler->next1D(), pmf);
+        if (!emitter)
+            return false;
+
+        Normal3f n;
+        Point2f positionSample = sampler->next2D();
+        Color3f weight = emitter->samplePhoton(ray, n, positionSample, sampler->next2D());
+        float pdfPos;
+        emitter->pdfPhoton(ray.o, n, ray.d, pdfPos, pdfDir);
+        pdfPos *= pmf;
+        if (weight.isZero() || !(pdfPos > 0.f) || !(pdfDir > 0.f))
+            return false;
+
+        v.type = Vertex::ELight;
+        v.delta = false;
+        v.p = ray.o;
+        v.n = n;
+        v.shFrame = Frame(n);
+        v.mesh = nullptr;
+        v.emitter = emitter;
+        v.beta = Color3f(1.f / pdfPos);
+        v.pdfFwd = pdfPos;
+        v.pdfRev = 0.f;
+
+        /* Radiance x cosine / (area density x direction density) */
+        beta = weight / pmf;
+        return true;
+    }
+
+    /**
+     * \brief Extend the subpath \c path (which holds its first vertex) along \c ray
+     *
+     * \param pdfFwd
+     *    Solid angle density of \c ray at the first vertex
+     * \return
+     *    Number of vertices of the subpath
+     */
+    int randomWalk(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta, float pdfFwd,
+            int maxVertices, Vertex *path) const {
+        int count = 1;
+        while (count < maxVertices) {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+                break;
+
+            Vertex &v = path[count], &prev = path[count - 1];
+            v.type = Vertex::ESurface;
+            v.p = its.p;
+            v.n = its.geoFrame.n;
+            v.shFrame = its.shFrame;
+            v.wi = its.toLocal(-ray.d);
+            v.mesh = its.mesh;
+            v.emitter = its.mesh->isEmitter() ? its.mesh->getEmitter() : nullptr;
+            v.delta = !its.mesh->getBSDF()->isDiffuse();
+            v.beta = beta;
+            v.pdfFwd = prev.convertDensity(pdfFwd, v);
+            v.pdfRev = 0.f;
+            if (++count >= maxVertices || its.mesh->isEmitter())
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            BSDFQueryRecord bRec(v.wi);
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+            float pdfRev = 0.f;
+            if (bRec.measure == EDiscrete) {
+                pdfFwd = 0.f;
+            } else {
+                pdfFwd = bsdf->pdf(bRec);
+                pdfRev = bsdf->pdf(BSDFQueryRecord(bRec.wo, bRec.wi, ESolidAngle));
+            }
+            prev.pdfRev = v.convertDensity(pdfRev, prev);
+
+            // Ruleta rusa
+            if (count > 3) {
+                float probRR = std::min(weight.getLuminance(), 1.0f);
+                if (sampler->next1D() >= probRR)
+                    break;
+                weight /= probRR;
+            }
+            beta *= weight;
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return count;
+    }
+
+    /// Radiance emitted by the emitter vertex \c v towards \c target
+    Color3f emitted(const Vertex &v, const Point3f &target) const {
+        EmitterQueryRecord eQR(target, v.p, v.shFrame.n);
+        return v.emitter->eval(eQR);
+    }
+
+    /// BSDF of the surface vertex \c v between its previous vertex and \c next
+    Color3f evalBSDF(const Vertex &v, const Vertex &next) const {
+        BSDFQueryRecord bRec(v.wi, v.shFrame.toLocal((next.p - v.p).normalized()), ESolidAngle);
+        return v.mesh->getBSDF()->eval(bRec);
+    }
+
+    /// Area density of the emitter vertex \c v as the start of a light subpath
+    float pdfLightOrigin(const Scene *scene, const Vertex &v) const {
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.shFrame.n, Vector3f(v.shFrame.n), pdfPos, pdfDir);
+        return scene->pdfEmitterPower(v.emitter) * pdfPos;
+    }
+
+    /// Area density of \c next when sampled by a light subpath starting at \c v
+    float pdfLight(const Vertex &v, const Vertex &next) const {
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.shFrame.n, (next.p - v.p).normalized(), pdfPos, pdfDir);
+        return v.convertDensity(pdfDir, next);
+    }
+
+    /// Area density of \c next when sampled from \c v, coming from \c prev
+    float pdf(const Vertex &v, const Vertex *prev, const Vertex &next) const {
+        if (v.type == Vertex::ELight)
+            return pdfLight(v, next);
+        if (v.type == Vertex::ECamera || !prev)
+            return 0.f;
+        BSDFQueryRecord bRec(v.shFrame.toLocal((prev->p - v.p).normalized()),
+            v.shFrame.toLocal((next.p - v.p).normalized()), ESolidAngle);
+        return v.convertDensity(v.mesh->getBSDF()->pdf(bRec), next);
+    }
+
+    /// Geometry term between two vertices, zero if they do not see each other
+    float geometry(const Scene *scene, const Vertex &a, const Vertex &b) const {
+        Vector3f d = b.p - a.p;
+        float dist = d.norm();
+        if (dist == 0.f)
+            return 0.f;
+        d /= dist;
+        float g = std::abs(a.shFrame.n.dot(d)) * std::abs(b.shFrame.n.dot(d)) / (dist * dist);
+        if (g == 0.f || scene->rayOccluded(Ray3f(a.p, d, Epsilon, dist - Epsilon)))
+            return 0.f;
+        return g;
+    }
+
+    /// Unweighted contribution of the strategy with \c s light and \c t camera vertices
+    Color3f connect(const Scene *scene, const Vertex *lightPath, const Vertex *cameraPath, int s, int t) const {
+        const Vertex &pt = cameraPath[t - 1];
+        if (s == 0)
+            return pt.isEmitter() ? pt.beta * emitted(pt, cameraPath[t - 2].p) : Color3f(0.f);
+
+        const Vertex &qs = lightPath[s - 1];
+        if (pt.delta || qs.delta || pt.isEmitter() || (s > 1 && qs.isEmitter()))
+            return Color3f(0.f);
+
+        Color3f L = s == 1 ? pt.beta * evalBSDF(pt, qs) * qs.beta * emitted(qs, pt.p)
+                           : qs.beta * evalBSDF(qs, pt) * evalBSDF(pt, qs) * pt.beta;
+        if (L.isZero())
+            return L;
+        return L * geometry(scene, qs, pt);
+    }
+
+    /**
+     * \brief Balance heuristic weight of the strategy (s, t)
+     *
+     * Temporarily sets the reverse densities of the connection vertices and
+     * of their predecessors for this connection, and sums the ratios of the
+     * path density under every other strategy to the one of (s, t).
+     */
+    float misWeight(const Scene *scene, Vertex *lightPath, Vertex *cameraPath, int s, int t) const {
+        if (s + t == 2)
+            return 1.f;
+
+        Vertex *qs = s > 0 ? &lightPath[s - 1] : nullptr, *qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+        Vertex *pt = &cameraPath[t - 1], *ptMinus = &cameraPath[t - 2];
+        float ptRev = pt->pdfRev, ptMinusRev = ptMinus->pdfRev;
+        float qsRev = qs ? qs->pdfRev : 0.f, qsMinusRev = qsMinus ? qsMinus->pdfRev : 0.f;
+        bool ptDelta = pt->delta, qsDelta = qs ? qs->delta : false;
+
+        pt->delta = false;
+        pt->pdfRev = s > 0 ? pdf(*qs, qsMinus, *pt) : pdfLightOrigin(scene, *pt);
+        ptMinus->pdfRev = s > 0 ? pdf(*pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+        if (qs) {
+            qs->delta = false;
+            qs->pdfRev = pdf(*pt, ptMinus, *qs);
+        }
+        if (qsMinus)
+            qsMinus->pdfRev = pdf(*qs, pt, *qsMinus);
+
+        auto remap0 = [](float f) { return f != 0.f ? f : 1.f; };
+        float sumRi = 0.f, ri = 1.f;
+        /* Fewer camera vertices (down to t = 2, light tracing is left out) */
+        for (int i = t - 1; i > 1; --i) {
+            ri *= remap0(cameraPath[i].pdfRev) / remap0(cameraPath[i].pdfFwd);
+            if (!cameraPath[i].delta && !cameraPath[i - 1].delta)
+                sumRi += ri;
+        }
+        /* Fewer light vertices */
+        ri = 1.f;
+        for (int i = s - 1; i >= 0; --i) {
+            ri *= remap0(lightPath[i].pdfRev) / remap0(lightPath[i].pdfFwd);
+            if (!lightPath[i].delta && (i == 0 || !lightPath[i - 1].delta))
+                sumRi += ri;
+        }
+
+        pt->pdfRev = ptRev;
+        ptMinus->pdfRev = ptMinusRev;
+        pt->delta = ptDelta;
+        if (qs) {
+            qs->pdfRev = qsRev;
+            qs->delta = qsDelta;
+        }
+        if (qsMinus)
+            qsMinus->pdfRev = qsMinusRev;
+        return 1.f / (1.f + sumRi);
+    }
+
+    int m_maxDepth;
+};
+
+NORI_REGISTER_CLASS(BDPT, "bdpt");
+NORI_NAMESPACE_END
@@ -0,0 +1,59 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone benchmark (like emitterbench): renders a scene with
+    pathtracer_nee and bdpt at 1, 2, 4, ... samples per pixel and reports the
+    RMSE against a reference image as a function of the render time.
+
+    Syntax: bdptbench <scene.xml> [reference.exr] [max spp]
+
+    Without a reference (or with "-"), one is rendered first with
+    pathtracer_nee at four times the largest sample count. The harness is
+    the ConvergenceBench of bench.h, shared with cachebench.
+*/
+
+#include <nori/bench.h>
+
+using namespace nori;
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [reference.exr] [max spp]" << endl;
+        return -1;
+    }
+
+    try {
+        ConvergenceBench bench(argv[1], argc > 3 ? (uint32_t) std::max(toInt(argv[3]), 1) : 64);
+        bench.loadReference(argc > 2 ? argv[2] : "");
+        Vector2i size = bench.getSize();
+
+        cout << endl << "RMSE against the reference (" << size.x() << "x" << size.y() << "):" << endl;
+        for (const char *name : { "pathtracer_nee", "bdpt" }) {
+            std::unique_ptr<Integrator> integrator = bench.createIntegrator(name);
+            bench.run(integrator.get(), [&](const ConvergenceBench::Pass &pass) {
+                cout << tfm::format("  %-15s %6i spp  %10.3f s  RMSE %10.4e  efficiency %10.4e", name, pass.spp,
+                    pass.seconds, pass.rmse, 1.0 / std::max(pass.rmse * pass.rmse * pass.seconds, 1e-30)) << endl;
+            });
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/sampler.h>
+#include <nori/bitmap.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Convergence benchmark shared by the stand-alone tools
+ * (bdptbench, cachebench)
+ *
+ * Loads a scene, obtains a reference image (from a file, or rendered with
+ * \c pathtracer_nee at four times the largest sample count), and renders
+ * integrators at 1, 2, 4, ... samples per pixel with independent random
+ * numbers, reporting the error against the reference after each pass.
+ */
+class ConvergenceBench {
+public:
+    /// Error of an image against the reference after a pass
+    struct Pass {
+        uint32_t spp;
+        /// Render time of all the passes so far
+        double seconds;
+        double rmse;
+        /// Mean signed error relative to the mean of the reference
+        double bias;
+    };
+
+    /// Load the scene \c filename (its directory is added to the file resolver)
+    ConvergenceBench(const std::string &filename, uint32_t maxSpp) : m_maxSpp(std::max(maxSpp, 1u)) {
+        filesystem::path path(filename);
+        getFileResolver()->prepend(path.parent_path());
+
+        m_root.reset(loadFromXML(filename));
+        if (m_root->getClassType() != NoriObject::EScene)
+            throw NoriException("\"%s\" does not describe a scene", filename);
+        m_scene = static_cast<Scene *>(m_root.get());
+    }
+
+    const Scene *getScene() const { return m_scene; }
+
+    Vector2i getSize() const { return m_scene->getCamera()->getOutputSize(); }
+
+    uint32_t getMaxSpp() const { return m_maxSpp; }
+
+    /**
+     * \brief Load the reference image \c filename, or render it when the
+     * name is empty or "-"
+     */
+    void loadReference(const std::string &filename) {
+        Vector2i size = getSize();
+        if (!filename.empty() && filename != "-") {
+            m_reference = Bitmap(filename);
+            if (m_reference.cols() != size.x() || m_reference.rows() != size.y())
+                throw NoriException("The reference \"%s\" does not have the size of the image", filename);
+            return;
+        }
+
+        Timer timer;
+        uint32_t spp = 4 * m_maxSpp;
+        m_reference = Bitmap(size);
+        m_reference.setConstant(Color3f(0.f));
+        render(createIntegrator("pathtracer_nee").get(), m_reference, spp, 1000);
+        for (int y = 0; y < (int) m_reference.rows(); ++y)
+            for (int x = 0; x < (int) m_reference.cols(); ++x)
+                m_reference(y, x) /= (float) spp;
+        cout << "Reference: pathtracer_nee, " << spp << " spp (" << timer.elapsedString() << ")" << endl;
+    }
+
+    /// Instantiate and preprocess the integrator \c name
+    std::unique_ptr<Integrator> createIntegrator(const std::string &name,
+            const PropertyList &props = PropertyList()) const {
+        std::unique_ptr<Integrator> integrator(static_cast<Integrator *>(
+            NoriObjectFactory::createInstance(name, props)));
+        integrator->preprocess(m_scene);
+        return integrator;
+    }
+
+    /**
+     * \brief Render \c integrator at doubling sample counts up to the
+     * maximum, calling \c report with a \ref Pass after each
+     */
+    template <typename Functor> void run(const Integrator *integrator, const Functor &report) const {
+        Bitmap sum(getSize());
+        sum.setConstant(Color3f(0.f));
+        double ms = 0;
+        uint32_t spp = 0;
+        for (uint32_t pass = 0; spp < m_maxSpp; ++pass) {
+            /* 1, 1, 2, 4, ... more samples: the total doubles each pass */
+            uint32_t count = std::min(std::max(spp, 1u), m_maxSpp - spp);
+            Timer timer;
+            render(integrator, sum, count, pass);
+            ms += timer.elapsed();
+            spp += count;
+
+            Pass result;
+            result.spp = spp;
+            result.seconds = ms / 1000.0;
+            compare(sum, spp, result.rmse, result.bias);
+            report(result);
+        }
+    }
+
+private:
+    /// Add \c spp samples per pixel (box filter) to the radiance sums in \c sum
+    void render(const Integrator *integrator, Bitmap &sum, uint32_t spp, uint64_t seed) const {
+        const Camera *camera = m_scene->getCamera();
+        tbb::parallel_for(tbb::blocked_range<int>(0, (int) sum.rows()), [&](const tbb::blocked_range<int> &range) {
+            for (int y = range.begin(); y < range.end(); ++y) {
+                std::unique_ptr<Sampler> sampler = createIndependentSampler((seed << 32) | (uint64_t) y);
+                for (int x = 0; x < (int) sum.cols(); ++x) {
+                    for (uint32_t i = 0; i < spp; ++i) {
+                        Ray3f ray;
+                        Point2f pixelSample = Point2f((float) x, (float) y) + sampler->next2D();
+                        Color3f value = camera->sampleRay(ray, pixelSample, sampler->next2D());
+                        value *= integrator->Li(m_scene, sampler.get(), ray);
+                        if (value.isValid())
+                            sum(y, x) += value;
+                    }
+                }
+            }
+        });
+    }
+
+    /// RMSE and relative bias of the mean of \c spp samples per pixel
+    void compare(const Bitmap &sum, double spp, double &rmse, double &bias) const {
+        double error = 0, signedError = 0, mean = 0;
+        for (int y = 0; y < (int) sum.rows(); ++y) {
+            for (int x = 0; x < (int) sum.cols(); ++x) {
+                Color3f diff = sum(y, x) / (float) spp - m_reference(y, x);
+                error += diff.matrix().squaredNorm() / 3.0;
+                signedError += diff.getLuminance();
+                mean += m_reference(y, x).getLuminance();
+            }
+        }
+        rmse = std::sqrt(error / std::max((double) sum.size(), 1.0));
+        bias = mean > 0 ? signedError / mean : 0.0;
+    }
+
+    std::unique_ptr<NoriObject> m_root;
+    const Scene *m_scene;
+    Bitmap m_reference;
+    uint32_t m_maxSpp;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,104 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone benchmark (like warptest): builds the BVH of a scene with
+    the median and the binned SAH builders, and collapsed into BVH4 and
+    BVH8 trees, and compares their build time, size, SAH cost and primary
+    ray throughput.
+
+    Syntax: bvhbench <scene.xml> [leaf size] [bins]
+*/
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+
+using namespace nori;
+
+/// One ray through the center of every pixel, in scanline order
+static std::vector<Ray3f> primaryRays(const Camera *camera) {
+    Vector2i size = camera->getOutputSize();
+    std::vector<Ray3f> rays;
+    rays.reserve((size_t) size.x() * size.y());
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            Ray3f ray;
+            camera->sampleRay(ray, Point2f(x + 0.5f, y + 0.5f), Point2f(0.5f));
+            rays.push_back(ray);
+        }
+    }
+    return rays;
+}
+
+static void benchmark(const Scene *scene, const PropertyList &props, const std::vector<Ray3f> &rays) {
+    Accel accel(props);
+    for (Mesh *mesh : scene->getMeshes())
+        accel.addMesh(mesh);
+    accel.build();
+
+    size_t hits = 0;
+    Intersection its;
+    Timer timer;
+    for (const Ray3f &ray : rays)
+        hits += accel.rayIntersect(ray, its, false);
+    double ms = timer.elapsed();
+
+    const Accel::BuildStats &stats = accel.getBuildStats();
+    cout << tfm::format("  %-44s build %10s  %8i nodes  SAH %8.2f  %10s  %7.2f Mrays/s (%i hits)",
+        accel.getBuilderName(), timeString(stats.time, true), stats.nodeCount, stats.sahCost,
+        memString(stats.memory), ms > 0 ? rays.size() / (ms * 1000.0) : 0.0, hits) << endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [leaf size] [bins]" << endl;
+        return -1;
+    }
+
+    try {
+        filesystem::path path(argv[1]);
+        getFileResolver()->prepend(path.parent_path());
+
+        std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+        if (root->getClassType() != NoriObject::EScene)
+            throw NoriException("\"%s\" does not describe a scene", argv[1]);
+        const Scene *scene = static_cast<const Scene *>(root.get());
+        std::vector<Ray3f> rays = primaryRays(scene->getCamera());
+
+        cout << endl << "Builders (" << rays.size() << " primary rays):" << endl;
+        for (const char *builder : { "median", "sah" }) {
+            for (int width : { 2, 4, 8 }) {
+                PropertyList props;
+                props.setString("bvhBuilder", builder);
+                props.setInteger("bvhWidth", width);
+                if (argc > 2)
+                    props.setInteger("bvhLeafSize", toInt(argv[2]));
+                if (argc > 3)
+                    props.setInteger("bvhBins", toInt(argv[3]));
+                benchmark(scene, props, rays);
+            }
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
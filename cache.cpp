@@ -0,0 +1,153 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/cache.h>
+#include <cstdio>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// Alignment of the arrays inside a cache file
+#define NORI_CACHE_ALIGNMENT 64
+
+NORI_NAMESPACE_BEGIN
+
+static const char cacheMagic[8] = { 'N', 'O', 'R', 'I', 'C', 'A', 'C', 'H' };
+
+CacheHash &CacheHash::add(const void *data_, size_t size) {
+    const uint8_t *data = (const uint8_t *) data_;
+    const uint64_t prime = 0x100000001b3ull;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        m_state = (m_state ^ word) * prime;
+        m_state ^= m_state >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    m_state = ((m_state ^ tail) * prime) ^ size;
+    return *this;
+}
+
+uint64_t CacheHash::get() const {
+    /* Final avalanche (from MurmurHash3) */
+    uint64_t h = m_state;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+CacheWriter::CacheWriter(const std::string &filename, uint64_t key)
+    : m_filename(filename), m_tmpFilename(filename + ".tmp") {
+    m_file.open(m_tmpFilename, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+        throw NoriException("Unable to create the cache file \"%s\"", m_tmpFilename);
+
+    uint32_t version = NORI_CACHE_VERSION;
+    m_file.write(cacheMagic, sizeof(cacheMagic));
+    write(version);
+    write(key);
+}
+
+void CacheWriter::writeArray(const void *data, size_t count, size_t elementSize) {
+    write((uint64_t) count);
+
+    static const char zeros[NORI_CACHE_ALIGNMENT] = { };
+    size_t pos = (size_t) m_file.tellp();
+    size_t padding = (NORI_CACHE_ALIGNMENT - pos % NORI_CACHE_ALIGNMENT) % NORI_CACHE_ALIGNMENT;
+    m_file.write(zeros, padding);
+    m_file.write((const char *) data, count * elementSize);
+}
+
+void CacheWriter::commit() {
+    m_file.close();
+    if (!m_file)
+        throw NoriException("Unable to write the cache file \"%s\"", m_tmpFilename);
+    std::remove(m_filename.c_str());
+    if (std::rename(m_tmpFilename.c_str(), m_filename.c_str()) != 0)
+        throw NoriException("Unable to rename the cache file to \"%s\"", m_filename);
+}
+
+CacheReader::CacheReader(const std::string &filename, uint64_t key) {
+#if defined(_WIN32)
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file)
+        return;
+    m_buffer.resize((size_t) file.tellg());
+    file.seekg(0);
+    file.read((char *) m_buffer.data(), m_buffer.size());
+    if (!file)
+        return;
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *ptr = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+            m_data = (const uint8_t *) ptr;
+            m_size = (size_t) st.st_size;
+        }
+    }
+    close(fd);
+#endif
+
+    size_t headerSize = sizeof(cacheMagic) + sizeof(uint32_t) + sizeof(uint64_t);
+    if (!m_data || m_size < headerSize || memcmp(m_data, cacheMagic, sizeof(cacheMagic)) != 0)
+        return;
+    m_pos = sizeof(cacheMagic);
+
+    uint32_t version;
+    uint64_t fileKey;
+    read(version);
+    read(fileKey);
+    m_valid = version == NORI_CACHE_VERSION && fileKey == key;
+}
+
+CacheReader::~CacheReader() {
+#if !defined(_WIN32)
+    if (m_data)
+        munmap((void *) m_data, m_size);
+#endif
+}
+
+const uint8_t *CacheReader::fetch(size_t size) {
+    if (size > m_size - m_pos)
+        throw NoriException("The cache file is truncated");
+    const uint8_t *result = m_data + m_pos;
+    m_pos += size;
+    return result;
+}
+
+void CacheReader::align() {
+    m_pos = std::min(m_size, (m_pos + NORI_CACHE_ALIGNMENT - 1) / NORI_CACHE_ALIGNMENT * NORI_CACHE_ALIGNMENT);
+}
+
+NORI_NAMESPACE_END
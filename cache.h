@@ -0,0 +1,148 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <fstream>
+#include <cstring>
+
+/// Format version of the scene cache, bump it whenever a cached structure changes
+#define NORI_CACHE_VERSION 1
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief 64-bit hash used to key the scene cache
+ *
+ * Consumes the data eight bytes at a time, which keeps hashing the
+ * buffers of a large mesh much cheaper than rebuilding anything from them.
+ */
+class CacheHash {
+public:
+    /// Hash \c size bytes starting at \c data
+    CacheHash &add(const void *data, size_t size);
+
+    /// Hash the bytes of a plain value
+    template <typename T> CacheHash &add(const T &value) { return add(&value, sizeof(T)); }
+
+    /// Hash a string (length and characters)
+    CacheHash &add(const std::string &value) {
+        add((uint64_t) value.size());
+        return add(value.data(), value.size());
+    }
+
+    /// Return the hash of everything added so far
+    uint64_t get() const;
+
+private:
+    uint64_t m_state = 0x9e3779b97f4a7c15ull;
+};
+
+/**
+ * \brief Sequential writer of a scene cache file
+ *
+ * Render checkpoints (see main.cpp) use the same format with their own key.
+ *
+ * The file starts with a header (magic, \c NORI_CACHE_VERSION, key),
+ * followed by arrays whose contents start on 64-byte boundaries so that
+ * they can be used in place once the file is mapped. The data goes to a
+ * temporary file that only replaces \c filename in \ref commit().
+ */
+class CacheWriter {
+public:
+    CacheWriter(const std::string &filename, uint64_t key);
+
+    /// Append a plain value
+    template <typename T> void write(const T &value) {
+        m_file.write((const char *) &value, sizeof(T));
+    }
+
+    /// Append an array of plain values
+    template <typename T> void write(const std::vector<T> &values) {
+        writeArray(values.data(), values.size(), sizeof(T));
+    }
+
+    /// Finish the file and move it to its final location
+    void commit();
+
+private:
+    void writeArray(const void *data, size_t count, size_t elementSize);
+
+    std::string m_filename, m_tmpFilename;
+    std::ofstream m_file;
+};
+
+/**
+ * \brief Reader of a scene cache file written by \ref CacheWriter
+ *
+ * The file is memory-mapped, so reading it costs little more than copying
+ * its arrays. All the read functions throw a \ref NoriException when the
+ * file is truncated.
+ */
+class CacheReader {
+public:
+    /**
+     * \brief Map \c filename
+     *
+     * \ref isValid() reports whether the file exists and was written with
+     * the same format version and key
+     */
+    CacheReader(const std::string &filename, uint64_t key);
+
+    /// Unmap the file
+    ~CacheReader();
+
+    /// Did the file exist and match the expected version and key?
+    bool isValid() const { return m_valid; }
+
+    /// Size of the mapped file in bytes
+    size_t getSize() const { return m_size; }
+
+    /// Read a plain value
+    template <typename T> void read(T &value) {
+        memcpy(&value, fetch(sizeof(T)), sizeof(T));
+    }
+
+    /// Read an array of plain values
+    template <typename T> void read(std::vector<T> &values) {
+        uint64_t count;
+        read(count);
+        align();
+        if (count > m_size / sizeof(T))
+            throw NoriException("The cache file is truncated");
+        const T *data = (const T *) fetch(count * sizeof(T));
+        values.assign(data, data + count);
+    }
+
+private:
+    /// Return the next \c size bytes and advance past them
+    const uint8_t *fetch(size_t size);
+
+    /// Skip to the next 64-byte boundary
+    void align();
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0, m_pos = 0;
+    bool m_valid = false;
+#if defined(_WIN32)
+    std::vector<uint8_t> m_buffer;
+#endif
+};
+
+NORI_NAMESPACE_END
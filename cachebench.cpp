@@ -0,0 +1,69 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone benchmark: renders a scene with pathtracer_nee without and
+    with the radiance cache at 1, 2, 4, ... samples per pixel and reports,
+    against a reference image, the RMSE and the bias (mean signed error relative to the mean of the reference) as a
+    function of the render time.
+
+    Syntax: cachebench <scene.xml> [reference.exr] [max spp] [cacheDepth]
+
+    Without a reference (or with "-"), one is rendered first with
+    pathtracer_nee (no cache) at four times the largest sample count. The
+    harness is the ConvergenceBench of bench.h, shared with bdptbench.
+*/
+
+#include <nori/bench.h>
+
+using namespace nori;
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [reference.exr] [max spp] [cacheDepth]" << endl;
+        return -1;
+    }
+
+    try {
+        ConvergenceBench bench(argv[1], argc > 3 ? (uint32_t) std::max(toInt(argv[3]), 1) : 64);
+        int cacheDepth = argc > 4 ? std::max(toInt(argv[4]), 1) : 3;
+        bench.loadReference(argc > 2 ? argv[2] : "");
+        Vector2i size = bench.getSize();
+
+        cout << endl << "Error against the reference (" << size.x() << "x" << size.y() << "):" << endl;
+        double seconds[2] = { 0, 0 };
+        for (int cached = 0; cached < 2; ++cached) {
+            PropertyList props;
+            props.setBoolean("radianceCache", cached != 0);
+            props.setInteger("cacheDepth", cacheDepth);
+            std::unique_ptr<Integrator> integrator = bench.createIntegrator("pathtracer_nee", props);
+            const char *name = cached ? "cache" : "no cache";
+            bench.run(integrator.get(), [&](const ConvergenceBench::Pass &pass) {
+                cout << tfm::format("  %-9s %6i spp  %10.3f s  RMSE %10.4e  bias %+8.3f%%", name, pass.spp,
+                    pass.seconds, pass.rmse, 100.0 * pass.bias) << endl;
+                seconds[cached] = pass.seconds;
+            });
+        }
+        cout << endl << tfm::format("Speed-up of the cache at %i spp: %.2fx", bench.getMaxSpp(),
+            seconds[0] / std::max(seconds[1], 1e-9)) << endl;
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -64,10 +64,10 @@ public:
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
+    /// Return the radius of the lens in world units (0: pinhole)
     float getApertureSize() const { return m_apertureSize; }
 
-    int getDofSamples() const { return m_dofSamples; }
-
+    /// Return the distance of the plane in focus from the lens
     float getFocalDistance() const { return m_focalDistance; }
 
     /// Return the camera's reconstruction filter in image space
@@ -82,7 +82,6 @@ protected:
     Vector2i m_outputSize;
     ReconstructionFilter *m_rfilter;
     float m_apertureSize;
-    int m_dofSamples;
     float m_focalDistance;
 };
 
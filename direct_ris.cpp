@@ -0,0 +1,297 @@
+/*
+	Direct illumination with resampled importance sampling (ReSTIR-style reservoirs)
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Direct illumination by resampled importance sampling (RIS)
+ *
+ * At every camera hit \c candidates cheap emitter samples are drawn with
+ * \ref Scene::sampleEmitterUnshadowed() and streamed through a weighted
+ * reservoir, using the luminance of the unshadowed contribution as target
+ * function. Only the sample that survives gets a shadow ray. With
+ * \c spatialReuse the reservoirs of \c spatialNeighbors random pixels within
+ * \c spatialRadius pixels (in the same render tile, with similar normal and
+ * depth) are merged into each pixel's reservoir before shading. The merge
+ * uses the 1/Z normalization, so the estimate stays unbiased.
+ *
+ * Targets and weights are expressed in area measure on the emitters, so a
+ * sample can be moved to a neighbouring pixel without a change of variables.
+ */
+class DirectRIS : public Integrator {
+    /// Camera hit that receives direct illumination
+    struct ShadingPoint {
+        Intersection its;
+        /// Direction towards the camera, in the local shading frame
+        Vector3f wi;
+        /// Emission seen directly by the camera ray
+        Color3f Le;
+        bool valid = false;
+    };
+
+    /// Weighted reservoir holding one emitter sample
+    struct Reservoir {
+        Point3f p;
+        Normal3f n;
+        const Emitter *emitter = nullptr;
+        /// Target function of the kept sample at the pixel that owns the reservoir
+        float target = 0.f;
+        /// Sum of the resampling weights and number of candidates seen
+        float wSum = 0.f, M = 0.f;
+
+        /// Offer a candidate, keep it with probability weight / wSum
+        void update(const Point3f &p_, const Normal3f &n_, const Emitter *emitter_,
+                float target_, float weight, float sample) {
+            wSum += weight;
+            if (weight > 0.f && sample * wSum < weight) {
+                p = p_;
+                n = n_;
+                emitter = emitter_;
+                target = target_;
+            }
+        }
+
+        /// Unbiased contribution weight of the kept sample (normalization \c Z)
+        float weight(float Z) const {
+            return emitter && target > 0.f && Z > 0.f ? wSum / (Z * target) : 0.f;
+        }
+    };
+
+public:
+    DirectRIS(const PropertyList &props) {
+        m_candidates = std::max(props.getInteger("candidates", 32), 1);
+        m_spatialReuse = props.getBoolean("spatialReuse", false);
+        m_spatialNeighbors = std::max(props.getInteger("spatialNeighbors", 4), 0);
+        m_spatialRadius = std::max(props.getInteger("spatialRadius", 8), 1);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        ShadingPoint x;
+        Reservoir r;
+        generate(scene, sampler, ray, x, r);
+        if (!x.valid)
+            return x.Le;
+
+        float W = r.weight(r.M);
+        if (W <= 0.f)
+            return x.Le;
+        Vector3f d = r.p - x.its.p;
+        if (scene->rayOccluded(Ray3f(x.its.p, d.normalized(), Epsilon, d.norm() - Epsilon)))
+            return x.Le;
+        return x.Le + integrand(x, r.p, r.n, r.emitter) * W;
+    }
+
+    bool supportsBatch() const { return true; }
+
+    void LiBatch(const Scene *scene, Sampler *sampler, RayBatch &batch) const {
+        static thread_local std::vector<ShadingPoint> points;
+        static thread_local std::vector<Reservoir> reservoirs, merged;
+        static thread_local RayQueue shadowRays;
+        static thread_local std::vector<uint8_t> shadowOccluded;
+        static thread_local std::vector<uint32_t> shadowPixel;
+        static thread_local std::vector<Color3f> contrib;
+        static thread_local std::vector<float> Z;
+
+        size_t count = batch.size();
+        points.resize(count);
+        reservoirs.resize(count);
+        batch.Li.resize(count);
+
+        /* Candidates: one reservoir per camera ray */
+        for (size_t k = 0; k < count; ++k) {
+            reservoirs[k] = Reservoir();
+            sampler->setState(batch.samplerStates[k]);
+            generate(scene, sampler, batch.rays.get(k), points[k], reservoirs[k]);
+            batch.samplerStates[k] = sampler->getState();
+        }
+
+        /* Optional spatial reuse between pixels of the tile */
+        std::vector<Reservoir> *shaded = &reservoirs;
+        Z.resize(count);
+        for (size_t k = 0; k < count; ++k)
+            Z[k] = reservoirs[k].M;
+        if (m_spatialReuse && batch.width > 0 && m_spatialNeighbors > 0) {
+            merged.resize(count);
+            for (size_t k = 0; k < count; ++k) {
+                sampler->setState(batch.samplerStates[k]);
+                merged[k] = spatialReuse(sampler, points, reservoirs, batch.width, k, Z[k]);
+            }
+            shaded = &merged;
+        }
+
+        /* Shade: one shadow ray per pixel, traced as a stream */
+        shadowRays.clear();
+        shadowPixel.clear();
+        contrib.clear();
+        for (size_t k = 0; k < count; ++k) {
+            const ShadingPoint &x = points[k];
+            batch.Li.set(k, x.Le);
+            if (!x.valid)
+                continue;
+            const Reservoir &r = (*shaded)[k];
+            float W = r.weight(Z[k]);
+            if (W <= 0.f)
+                continue;
+            Color3f value = integrand(x, r.p, r.n, r.emitter) * W;
+            if (value.isZero())
+                continue;
+            Vector3f d = r.p - x.its.p;
+            shadowRays.push(Ray3f(x.its.p, d.normalized(), Epsilon, d.norm() - Epsilon));
+            shadowPixel.push_back((uint32_t) k);
+            contrib.push_back(value);
+        }
+
+        scene->rayOccluded(shadowRays, shadowOccluded);
+        for (size_t i = 0; i < shadowRays.size(); ++i) {
+            if (!shadowOccluded[i])
+                batch.Li.add(shadowPixel[i], contrib[i]);
+        }
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "DirectRIS[\n"
+            "  candidates = %i,\n"
+            "  spatialReuse = %s,\n"
+            "  spatialNeighbors = %i,\n"
+            "  spatialRadius = %i\n"
+            "]",
+            m_candidates, m_spatialReuse ? "true" : "false",
+            m_spatialNeighbors, m_spatialRadius
+        );
+    }
+
+private:
+    /**
+     * \brief Unshadowed contribution of the emitter point (p, n) to \c x,
+     * in area measure: f * Le * cos(x) * cos(y) / d^2
+     */
+    Color3f integrand(const ShadingPoint &x, const Point3f &p, const Normal3f &n, const Emitter *emitter) const {
+        Vector3f d = p - x.its.p;
+        float dist2 = d.squaredNorm();
+        if (dist2 <= 0.f)
+            return Color3f(0.f);
+        Vector3f wo = d / std::sqrt(dist2);
+        float cosY = n.dot(-wo);
+        if (cosY <= 0.f)
+            return Color3f(0.f);
+
+        Color3f Le = emitter->eval(EmitterQueryRecord(x.its.p, p, n));
+        if (Le.isZero())
+            return Color3f(0.f);
+
+        Vector3f woLocal = x.its.toLocal(wo);
+        BSDFQueryRecord bRec(x.wi, woLocal, ESolidAngle);
+        Color3f f = x.its.mesh->getBSDF()->eval(bRec);
+        return f * Le * std::abs(Frame::cosTheta(woLocal)) * cosY / dist2;
+    }
+
+    /// Trace the camera ray and fill the reservoir of its hit with \c m_candidates emitter samples
+    void generate(const Scene *scene, Sampler *sampler, const Ray3f &ray, ShadingPoint &x, Reservoir &r) const {
+        x.valid = false;
+        x.Le = Color3f(0.f);
+        if (!scene->rayIntersect(ray, x.its))
+            return;
+
+        if (x.its.mesh->isEmitter()) {
+            EmitterQueryRecord eQR(ray.o, x.its.p, x.its.shFrame.n);
+            x.Le = x.its.mesh->getEmitter()->eval(eQR);
+            return;
+        }
+
+        x.wi = x.its.toLocal(-ray.d);
+        x.valid = true;
+
+        for (int i = 0; i < m_candidates; ++i) {
+            EmitterQueryRecord lRec(x.its.p, x.its.shFrame.n);
+            scene->sampleEmitterUnshadowed(lRec, sampler->next2D());
+            float u = sampler->next1D();
+            r.M += 1.f;
+            if (!(lRec.pdf > 0.f) || !lRec.emitter)
+                continue;
+
+            /* Source pdf in area measure */
+            float dist2 = (lRec.p - x.its.p).squaredNorm();
+            float cosY = lRec.n.dot(-lRec.wi);
+            if (cosY <= 0.f || dist2 <= 0.f)
+                continue;
+            float pdfArea = lRec.pdf * cosY / dist2;
+
+            float target = integrand(x, lRec.p, lRec.n, lRec.emitter).getLuminance();
+            r.update(lRec.p, lRec.n, lRec.emitter, target, target / pdfArea, u);
+        }
+    }
+
+    /// Are two camera hits similar enough to share emitter samples?
+    static bool similar(const ShadingPoint &a, const ShadingPoint &b) {
+        return b.valid && a.its.shFrame.n.dot(b.its.shFrame.n) > 0.9f &&
+            std::abs(a.its.t - b.its.t) <= 0.1f * a.its.t;
+    }
+
+    /**
+     * \brief Merge the reservoir of pixel \c k with those of random neighbours
+     *
+     * \param Z
+     *    Receives the number of candidates of the merged reservoirs that
+     *    could have produced the kept sample
+     */
+    Reservoir spatialReuse(Sampler *sampler, const std::vector<ShadingPoint> &points,
+            const std::vector<Reservoir> &reservoirs, uint32_t width, size_t k, float &Z) const {
+        const ShadingPoint &x = points[k];
+        Reservoir s;
+        if (!x.valid)
+            return s;
+
+        int height = (int) ((points.size() + width - 1) / width);
+        int px = (int) (k % width), py = (int) (k / width);
+
+        /* Reservoirs taking part: this pixel first, then the neighbours */
+        std::vector<size_t> sources(1, k);
+        for (int i = 0; i < m_spatialNeighbors; ++i) {
+            Point2f offset = sampler->next2D();
+            int qx = px + (int) std::floor((2.f * offset.x() - 1.f) * m_spatialRadius + 0.5f);
+            int qy = py + (int) std::floor((2.f * offset.y() - 1.f) * m_spatialRadius + 0.5f);
+            if (qx < 0 || qy < 0 || qx >= (int) width || qy >= height)
+                continue;
+            size_t q = (size_t) qy * width + (size_t) qx;
+            if (q == k || q >= points.size() || !similar(x, points[q]))
+                continue;
+            sources.push_back(q);
+        }
+
+        for (size_t q : sources) {
+            const Reservoir &r = reservoirs[q];
+            float W = r.weight(r.M);
+            if (W > 0.f) {
+                float target = integrand(x, r.p, r.n, r.emitter).getLuminance();
+                s.update(r.p, r.n, r.emitter, target, target * W * r.M, sampler->next1D());
+            }
+            s.M += r.M;
+        }
+
+        /* 1/Z: only count the pixels whose own candidates could have produced the kept sample */
+        Z = 0.f;
+        if (s.emitter) {
+            for (size_t q : sources) {
+                if (integrand(points[q], s.p, s.n, s.emitter).getLuminance() > 0.f)
+                    Z += reservoirs[q].M;
+            }
+        }
+        return s;
+    }
+
+    int m_candidates;
+    bool m_spatialReuse;
+    int m_spatialNeighbors;
+    int m_spatialRadius;
+};
+
+NORI_REGISTER_CLASS(DirectRIS, "direct_ris");
+NORI_NAMESPACE_END
@@ -19,12 +19,15 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/ray.h>
 
 NORI_NAMESPACE_BEGIN
 
 struct EmitterQueryRecord {
 	/// Origin point from which we sample the emitter
 	Point3f ref;
+	/// Shading normal at the origin point (zero if unknown), used to choose the emitter
+	Normal3f refN;
 	/// Sampled point on the emitter
 	Point3f p;
 	/// Normal at the emitter point
@@ -33,17 +36,26 @@ struct EmitterQueryRecord {
 	Vector3f wi;
 	/// Probability
 	float pdf;
+	/// Emitter the point was sampled on (set by \ref Scene::sampleEmitter())
+	const Emitter *emitter = nullptr;
+	/// Triangle of the emitter mesh that contains \c p
+	uint32_t triangle = 0;
 
 	/**
 	 * \brief Create a query record that can be used to query the
 	 * sampling density after having intersected an area emitter
 	 */
 	EmitterQueryRecord(const Point3f& ref) :
-		ref(ref){
+		ref(ref), refN(0.0f) {
+	}
+
+	/// Query record for sampling an emitter from a surface point with shading normal \c refN
+	EmitterQueryRecord(const Point3f &ref, const Normal3f &refN) :
+		ref(ref), refN(refN) {
 	}
 
 	EmitterQueryRecord(const Point3f &ref, const Point3f &p, const Normal3f &n):
-		ref(ref), p(p), n(n) {
+		ref(ref), refN(0.0f), p(p), n(n) {
 		wi = (p - ref).normalized();
 	}
 };
@@ -61,12 +73,57 @@ public:
 	virtual float pdf(const EmitterQueryRecord &lRec) const = 0;
 
 	virtual float getLuminance() const = 0;
+
+	/**
+	 * \brief Sample a photon leaving the emitter
+	 *
+	 * Sets \c ray to the origin and direction of the photon and \c n to the
+	 * normal at its origin, and returns its emitted radiance x cosine
+	 * divided by the density of the sample (flux per photon, see
+	 * \ref pdfPhoton()). Zero for emitters that cannot emit photons.
+	 */
+	virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, const Point2f &positionSample,
+			const Point2f &directionSample) const {
+		return Color3f(0.0f);
+	}
+
+	/**
+	 * \brief Densities with which \ref samplePhoton() produces the origin
+	 * \c p (normal \c n) and, from there, the direction \c d
+	 *
+	 * \param pdfPos
+	 *    Area density of the origin
+	 * \param pdfDir
+	 *    Solid angle density of the direction
+	 */
+	virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+			float &pdfPos, float &pdfDir) const {
+		pdfPos = pdfDir = 0.0f;
+	}
+
+	/**
+	 * \brief Total emitted power: radiance luminance x surface area x pi
+	 *
+	 * Valid once \ref computePower() has been called by \ref Scene::activate().
+	 * Zero for emitters that cannot report it (see \ref hasPower()), and for
+	 * emitters that do not emit.
+	 */
+	float getPower() const { return m_power; }
+
+	/// Can \ref computePower() report the emitted power of this emitter?
+	virtual bool hasPower() const { return false; }
+
+	/// Compute (once) the value returned by \ref getPower()
+	virtual float computePower() { return m_power = 0.0f; }
 	
 	/**
 	 * \brief Return the type of object (i.e. Mesh/Emitter/etc.) 
 	 * provided by this instance
 	 * */
 	EClassType getClassType() const { return EEmitter; }
+
+protected:
+	float m_power = 0.0f;
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,130 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone benchmark (like warptest): estimates the direct illumination
+    at the primary hits of a scene with each emitter selection strategy
+    (luminance, power, light BVH) and reports the variance of the estimate
+    against the time spent, i.e. which strategy converges fastest.
+
+    Syntax: emitterbench <scene.xml> [samples per point] [points]
+*/
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/bsdf.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+
+using namespace nori;
+
+/// Camera hits on a regular grid of pixels (emitters excluded)
+static std::vector<std::pair<Intersection, Vector3f>> shadingPoints(const Scene *scene, int count) {
+    const Camera *camera = scene->getCamera();
+    Vector2i size = camera->getOutputSize();
+    int stride = std::max(1, (int) std::sqrt((double) size.x() * size.y() / std::max(count, 1)));
+
+    std::vector<std::pair<Intersection, Vector3f>> points;
+    for (int y = stride / 2; y < size.y(); y += stride) {
+        for (int x = stride / 2; x < size.x(); x += stride) {
+            Ray3f ray;
+            camera->sampleRay(ray, Point2f(x + 0.5f, y + 0.5f), Point2f(0.5f));
+            Intersection its;
+            if (scene->rayIntersect(ray, its) && !its.mesh->isEmitter())
+                points.emplace_back(its, its.toLocal(-ray.d));
+        }
+    }
+    return points;
+}
+
+static void benchmark(Scene *scene, const std::string &strategy,
+        const std::vector<std::pair<Intersection, Vector3f>> &points, int samples) {
+    try {
+        scene->setEmitterSampling(strategy);
+        scene->buildEmitterSampling();
+    } catch (const std::exception &e) {
+        cout << tfm::format("  %-10s n/a (%s)", strategy, e.what()) << endl;
+        return;
+    }
+
+    pcg32 rng;
+    double variance = 0, relVariance = 0;
+    Timer timer;
+    for (const auto &point : points) {
+        const Intersection &its = point.first;
+        const BSDF *bsdf = its.mesh->getBSDF();
+
+        /* Mean and variance of the luminance of the one-sample estimator */
+        double sum = 0, sum2 = 0;
+        for (int i = 0; i < samples; ++i) {
+            EmitterQueryRecord lRec(its.p, its.shFrame.n);
+            Color3f Le = scene->sampleEmitter(lRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+            Vector3f wo = its.toLocal(lRec.wi);
+            BSDFQueryRecord bRec(point.second, wo, ESolidAngle);
+            Color3f f = Le * bsdf->eval(bRec) * std::abs(Frame::cosTheta(wo));
+            double value = f.getLuminance();
+            sum += value;
+            sum2 += value * value;
+        }
+        double mean = sum / samples;
+        double var = std::max(sum2 / samples - mean * mean, 0.0);
+        variance += var;
+        if (mean > 0)
+            relVariance += var / (mean * mean);
+    }
+    double ms = timer.elapsed();
+
+    variance /= std::max((size_t) 1, points.size());
+    relVariance /= std::max((size_t) 1, points.size());
+    double perSample = ms / std::max((double) points.size() * samples, 1.0);
+    cout << tfm::format("  %-10s variance %10.4e  rel. variance %10.4e  %8.3f us/sample  efficiency %10.4e",
+        strategy, variance, relVariance, perSample * 1000.0,
+        relVariance > 0 && perSample > 0 ? 1.0 / (relVariance * perSample) : 0.0) << endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [samples per point] [points]" << endl;
+        return -1;
+    }
+
+    try {
+        filesystem::path path(argv[1]);
+        getFileResolver()->prepend(path.parent_path());
+
+        std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+        if (root->getClassType() != NoriObject::EScene)
+            throw NoriException("\"%s\" does not describe a scene", argv[1]);
+        Scene *scene = static_cast<Scene *>(root.get());
+
+        int samples = argc > 2 ? std::max(toInt(argv[2]), 2) : 64;
+        int count = argc > 3 ? std::max(toInt(argv[3]), 1) : 4096;
+        auto points = shadingPoints(scene, count);
+
+        cout << endl << "Emitter selection (" << scene->getEmitters().size() << " emitters, "
+             << points.size() << " shading points, " << samples << " samples each):" << endl;
+        for (const char *strategy : { "luminance", "power", "bvh" })
+            benchmark(scene, strategy, points, samples);
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/raybatch.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -53,6 +54,30 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /// Does this integrator provide a staged implementation of \ref LiBatch()?
+    virtual bool supportsBatch() const { return false; }
+
+    /**
+     * \brief Sample the incident radiance along all the rays of a batch
+     *
+     * Integrators that support it process the whole batch in stages
+     * (intersect, shade, shadow test, accumulate) instead of one path at
+     * a time. The default implementation simply calls \ref Li() per ray.
+     *
+     * \param scene
+     *    A pointer to the underlying scene
+     * \param sampler
+     *    A pointer to a sample generator
+     * \param batch
+     *    Camera rays on input; \c batch.Li receives one estimate per ray
+     */
+    virtual void LiBatch(const Scene *scene, Sampler *sampler, RayBatch &batch) const {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            sampler->setState(batch.samplerStates[i]);
+            batch.Li.set(i, Li(scene, sampler, batch.rays.get(i)));
+        }
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
@@ -0,0 +1,357 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/lightbvh.h>
+#include <nori/emitter.h>
+#include <Eigen/Geometry>
+
+/// Number of buckets per axis of the split search
+#define NORI_LIGHTBVH_BUCKETS 12
+
+/// Below this depth splits are chosen by cost, deeper nodes are split at the median
+#define NORI_LIGHTBVH_MAX_SAOH_DEPTH 64
+
+#define NORI_LIGHTBVH_INVALID ((uint32_t) -1)
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    inline float safeSqrt(float value) {
+        return std::sqrt(std::max(value, 0.f));
+    }
+
+    inline float safeAcos(float value) {
+        return std::acos(std::min(std::max(value, -1.f), 1.f));
+    }
+
+    /// cos(max(0, a - b)) from the sines and cosines of a and b
+    inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 1.f;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    /// sin(max(0, a - b)) from the sines and cosines of a and b
+    inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 0.f;
+        return sinA * cosB - cosA * sinB;
+    }
+
+    /// Smallest cone that contains the cones (a, cosA) and (b, cosB)
+    void coneUnion(Vector3f &a, float &cosA, const Vector3f &b, float cosB) {
+        float thetaA = safeAcos(cosA), thetaB = safeAcos(cosB);
+        float thetaD = safeAcos(a.dot(b));
+        if (std::min(thetaD + thetaB, (float) M_PI) <= thetaA)
+            return;
+        if (std::min(thetaD + thetaA, (float) M_PI) <= thetaB) {
+            a = b;
+            cosA = cosB;
+            return;
+        }
+
+        float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+        Vector3f k = a.cross(b);
+        if (thetaO >= M_PI || k.squaredNorm() == 0.f) {
+            cosA = -1.f;
+            return;
+        }
+
+        /* Rotate 'a' towards 'b' by thetaO - thetaA (k is orthogonal to a) */
+        float thetaR = thetaO - thetaA;
+        k.normalize();
+        a = (a * std::cos(thetaR) + k.cross(a) * std::sin(thetaR)).normalized();
+        cosA = std::cos(thetaO);
+    }
+
+    /// Solid angle measure of the directions a set with normal spread thetaO emits into
+    float orientationMeasure(float cosThetaO) {
+        float thetaO = safeAcos(cosThetaO), sinThetaO = std::sin(thetaO);
+        float thetaW = std::min(thetaO + 0.5f * (float) M_PI, (float) M_PI);
+        return 2.f * (float) M_PI * (1.f - cosThetaO) + 0.5f * (float) M_PI *
+            (2.f * thetaW * sinThetaO - std::cos(thetaO - 2.f * thetaW) - 2.f * thetaO * sinThetaO + cosThetaO);
+    }
+
+    /// Surface area orientation heuristic: cost of a subtree with these bounds
+    float saohCost(const LightBounds &bounds) {
+        if (bounds.power <= 0.f)
+            return 0.f;
+        return bounds.power * orientationMeasure(bounds.cosThetaO) * bounds.bbox.getSurfaceArea();
+    }
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b) {
+    if (a.power <= 0.f)
+        return b;
+    if (b.power <= 0.f)
+        return a;
+
+    LightBounds result = a;
+    result.bbox.expandBy(b.bbox);
+    coneUnion(result.axis, result.cosThetaO, b.axis, b.cosThetaO);
+    result.power = a.power + b.power;
+    return result;
+}
+
+float LightBounds::importance(const Point3f &p, const Normal3f &n) const {
+    if (power <= 0.f)
+        return 0.f;
+
+    /* Distance to the center, clamped so that points inside do not blow up */
+    Point3f center = bbox.getCenter();
+    Vector3f d = p - center;
+    float radius2 = 0.25f * bbox.getExtents().squaredNorm();
+    float dist2 = std::max(d.squaredNorm(), radius2);
+
+    /* Angle between the cone axis and the direction to p */
+    Vector3f wi = d.squaredNorm() > 0.f ? Vector3f(d.normalized()) : axis;
+    float cosThetaW = axis.dot(wi), sinThetaW = safeSqrt(1.f - cosThetaW * cosThetaW);
+    float sinThetaO = safeSqrt(1.f - cosThetaO * cosThetaO);
+
+    /* Directions subtended by the bounding sphere of the box */
+    float cosThetaB = -1.f;
+    if (d.squaredNorm() > radius2)
+        cosThetaB = safeSqrt(1.f - radius2 / d.squaredNorm());
+    float sinThetaB = safeSqrt(1.f - cosThetaB * cosThetaB);
+
+    /* Smallest angle between a normal of the set and a direction to p */
+    float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+    /* One-sided emitters: nothing reaches p from behind */
+    if (cosThetaP <= 0.f)
+        return 0.f;
+
+    float result = power * cosThetaP / dist2;
+
+    /* Bound of the cosine at the receiver */
+    if (!n.isZero()) {
+        float cosThetaI = std::abs(wi.dot(n)), sinThetaI = safeSqrt(1.f - cosThetaI * cosThetaI);
+        result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+    return std::max(result, 0.f);
+}
+
+LightBVH::LightBVH(const std::vector<Mesh *> &meshes) {
+    std::vector<Primitive> prims;
+    for (const Mesh *mesh : meshes) {
+        if (!mesh->isEmitter())
+            continue;
+        m_meshOffset[mesh] = (uint32_t) m_leaf.size();
+
+        const MatrixXf &V = mesh->getVertexPositions();
+        const MatrixXf &N = mesh->getVertexNormals();
+        const MatrixXu &F = mesh->getIndices();
+        float radiance = mesh->getEmitter()->getLuminance() * (float) M_PI;
+
+        for (uint32_t f = 0; f < mesh->getTriangleCount(); ++f) {
+            m_leaf.push_back(NORI_LIGHTBVH_INVALID);
+
+            Primitive prim;
+            prim.mesh = mesh;
+            prim.triangle = f;
+            prim.bounds.bbox = mesh->getBoundingBox(f);
+            prim.bounds.power = radiance * mesh->surfaceArea(f);
+            prim.centroid = mesh->getCentroid(f);
+            if (!(prim.bounds.power > 0.f))
+                continue;
+
+            /* Normal cone: the face normal, widened to the vertex normals if there are any */
+            Point3f p0 = V.col(F(0, f)), p1 = V.col(F(1, f)), p2 = V.col(F(2, f));
+            prim.bounds.axis = (p1 - p0).cross(p2 - p0).normalized();
+            prim.bounds.cosThetaO = 1.f;
+            if (N.size() > 0) {
+                for (int k = 0; k < 3; ++k)
+                    coneUnion(prim.bounds.axis, prim.bounds.cosThetaO,
+                        Vector3f(N.col(F(k, f)).normalized()), 1.f);
+            }
+            prims.push_back(prim);
+        }
+    }
+
+    if (prims.empty())
+        return;
+
+    m_nodes.reserve(2 * prims.size() - 1);
+    m_parent.reserve(2 * prims.size() - 1);
+    build(prims, 0, (uint32_t) prims.size(), NORI_LIGHTBVH_INVALID, 0);
+    m_prims = std::move(prims);
+
+    for (uint32_t i = 0; i < (uint32_t) m_nodes.size(); ++i) {
+        if (!m_nodes[i].leaf)
+            continue;
+        const Primitive &prim = m_prims[m_nodes[i].offset];
+        m_leaf[m_meshOffset[prim.mesh] + prim.triangle] = i;
+    }
+}
+
+uint32_t LightBVH::build(std::vector<Primitive> &prims, uint32_t begin, uint32_t end,
+        uint32_t parent, int depth) {
+    uint32_t nodeIdx = (uint32_t) m_nodes.size();
+    m_nodes.emplace_back();
+    m_parent.push_back(parent);
+
+    LightBounds bounds;
+    BoundingBox3f centroidBox;
+    for (uint32_t i = begin; i < end; ++i) {
+        bounds = LightBounds::merge(bounds, prims[i].bounds);
+        centroidBox.expandBy(prims[i].centroid);
+    }
+    m_nodes[nodeIdx].bounds = bounds;
+
+    uint32_t count = end - begin;
+    if (count == 1) {
+        m_nodes[nodeIdx].offset = begin;
+        m_nodes[nodeIdx].leaf = true;
+        return nodeIdx;
+    }
+
+    /* Bucketed split search with the surface area orientation heuristic */
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::infinity();
+    Vector3f extents = bounds.bbox.getExtents();
+    if (depth < NORI_LIGHTBVH_MAX_SAOH_DEPTH) {
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = centroidBox.min[axis], hi = centroidBox.max[axis];
+            if (hi <= lo)
+                continue;
+
+            LightBounds buckets[NORI_LIGHTBVH_BUCKETS];
+            for (uint32_t i = begin; i < end; ++i) {
+                int b = std::min((int) (NORI_LIGHTBVH_BUCKETS * (prims[i].centroid[axis] - lo) / (hi - lo)),
+                    NORI_LIGHTBVH_BUCKETS - 1);
+                buckets[b] = LightBounds::merge(buckets[b], prims[i].bounds);
+            }
+
+            /* Long thin boxes should be split across, not along */
+            float regularization = extents.maxCoeff() / std::max(extents[axis], 1e-12f);
+            for (int split = 0; split < NORI_LIGHTBVH_BUCKETS - 1; ++split) {
+                LightBounds left, right;
+                for (int b = 0; b <= split; ++b)
+                    left = LightBounds::merge(left, buckets[b]);
+                for (int b = split + 1; b < NORI_LIGHTBVH_BUCKETS; ++b)
+                    right = LightBounds::merge(right, buckets[b]);
+                float cost = regularization * (saohCost(left) + saohCost(right));
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+    }
+
+    uint32_t mid = begin;
+    if (bestAxis >= 0) {
+        float lo = centroidBox.min[bestAxis], hi = centroidBox.max[bestAxis];
+        mid = (uint32_t) (std::partition(prims.begin() + begin, prims.begin() + end,
+            [&](const Primitive &prim) {
+                int b = std::min((int) (NORI_LIGHTBVH_BUCKETS * (prim.centroid[bestAxis] - lo) / (hi - lo)),
+                    NORI_LIGHTBVH_BUCKETS - 1);
+                return b <= bestSplit;
+            }) - prims.begin());
+    }
+
+    if (mid == begin || mid == end) {
+        /* Identical centroids or a very deep tree: object median split */
+        int axis = centroidBox.getLargestAxis();
+        mid = begin + count / 2;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+            [&](const Primitive &a, const Primitive &b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    build(prims, begin, mid, nodeIdx, depth + 1);
+    uint32_t right = build(prims, mid, end, nodeIdx, depth + 1);
+
+    m_nodes[nodeIdx].offset = right;
+    m_nodes[nodeIdx].leaf = false;
+    return nodeIdx;
+}
+
+bool LightBVH::sample(const Point3f &p, const Normal3f &n, float &sample,
+        const Mesh *&mesh, uint32_t &triangle, float &pmf) const {
+    if (m_nodes.empty())
+        return false;
+
+    uint32_t nodeIdx = 0;
+    pmf = 1.f;
+    if (m_nodes[0].leaf && m_nodes[0].bounds.importance(p, n) <= 0.f)
+        return false;
+
+    while (!m_nodes[nodeIdx].leaf) {
+        /* Pick a child with probability proportional to its importance */
+        uint32_t left = nodeIdx + 1, right = m_nodes[nodeIdx].offset;
+        float importanceLeft = m_nodes[left].bounds.importance(p, n);
+        float importanceRight = m_nodes[right].bounds.importance(p, n);
+        float sum = importanceLeft + importanceRight;
+        if (!(sum > 0.f))
+            return false;
+
+        float probLeft = importanceLeft / sum;
+        if (sample < probLeft) {
+            sample = std::min(sample / probLeft, NORI_ONE_MINUS_EPSILON);
+            pmf *= probLeft;
+            nodeIdx = left;
+        } else {
+            sample = std::min((sample - probLeft) / (1.f - probLeft), NORI_ONE_MINUS_EPSILON);
+            pmf *= importanceRight / sum;
+            nodeIdx = right;
+        }
+    }
+
+    const Primitive &prim = m_prims[m_nodes[nodeIdx].offset];
+    mesh = prim.mesh;
+    triangle = prim.triangle;
+    return true;
+}
+
+float LightBVH::pmf(const Point3f &p, const Normal3f &n, const Mesh *mesh, uint32_t triangle) const {
+    auto it = m_meshOffset.find(mesh);
+    if (it == m_meshOffset.end())
+        return 0.f;
+    uint32_t nodeIdx = m_leaf[it->second + triangle];
+    if (nodeIdx == NORI_LIGHTBVH_INVALID)
+        return 0.f;
+
+    /* Same choices as sample(), from the leaf up to the root */
+    float pmf = 1.f;
+    if (nodeIdx == 0)
+        return m_nodes[0].bounds.importance(p, n) > 0.f ? 1.f : 0.f;
+
+    while (nodeIdx != 0) {
+        uint32_t parent = m_parent[nodeIdx];
+        uint32_t left = parent + 1, right = m_nodes[parent].offset;
+        float importanceLeft = m_nodes[left].bounds.importance(p, n);
+        float importanceRight = m_nodes[right].bounds.importance(p, n);
+        float sum = importanceLeft + importanceRight;
+        if (!(sum > 0.f))
+            return 0.f;
+        pmf *= (nodeIdx == left ? importanceLeft : importanceRight) / sum;
+        nodeIdx = parent;
+    }
+    return pmf;
+}
+
+size_t LightBVH::getMemory() const {
+    return m_nodes.size() * sizeof(Node) + m_parent.size() * sizeof(uint32_t) +
+        m_prims.size() * sizeof(Primitive) + m_leaf.size() * sizeof(uint32_t) +
+        m_meshOffset.size() * (sizeof(const Mesh *) + sizeof(uint32_t));
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,122 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Spatial and directional bounds of a set of emitting triangles
+ *
+ * The normals of the triangles lie in a cone (\c axis, \c cosThetaO), and
+ * every triangle emits into the hemisphere around its normal, so the
+ * emission of the whole set is bounded by the cone widened by 90 degrees.
+ */
+struct LightBounds {
+    BoundingBox3f bbox;
+    /// Axis of the normal cone
+    Vector3f axis = Vector3f(0.f, 0.f, 1.f);
+    /// Cosine of the half-angle of the normal cone (-1: all directions)
+    float cosThetaO = 1.f;
+    /// Emitted power
+    float power = 0.f;
+
+    /// Bounds of the union of two sets
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+
+    /**
+     * \brief Conservative estimate of the contribution of the set to the
+     * point \c p with shading normal \c n
+     *
+     * Power over squared distance, times the bounds of the cosine at the
+     * emitter and of the cosine at \c p (ignored if \c n is zero). It is
+     * zero only if no triangle of the set can illuminate \c p.
+     */
+    float importance(const Point3f &p, const Normal3f &n) const;
+};
+
+/**
+ * \brief Light hierarchy for many-light sampling
+ *
+ * Binary tree over all the emitting triangles of the scene, with the
+ * \ref LightBounds of every subtree. An emitter triangle is chosen by
+ * descending from the root and picking each child with probability
+ * proportional to its importance for the shading point, so that nearby
+ * and well-oriented lights receive most of the samples. The probability
+ * of a given triangle is recomputed by walking from its leaf up to the
+ * root, which is what the MIS weights of the integrators need.
+ */
+class LightBVH {
+public:
+    /// Build the hierarchy over the triangles of the emitter meshes of \c meshes
+    LightBVH(const std::vector<Mesh *> &meshes);
+
+    /**
+     * \brief Choose an emitter triangle for the shading point \c p
+     *
+     * \param sample
+     *    Uniform sample, adjusted so that it can be reused afterwards
+     * \param pmf
+     *    Receives the discrete probability of the chosen triangle
+     * \return
+     *    \c false if no triangle can illuminate \c p
+     */
+    bool sample(const Point3f &p, const Normal3f &n, float &sample,
+            const Mesh *&mesh, uint32_t &triangle, float &pmf) const;
+
+    /// Probability with which \ref sample() chooses \c triangle of \c mesh for \c p
+    float pmf(const Point3f &p, const Normal3f &n, const Mesh *mesh, uint32_t triangle) const;
+
+    /// Number of emitting triangles in the hierarchy
+    size_t getTriangleCount() const { return m_prims.size(); }
+
+    /// Number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Memory used by the nodes and the lookup tables (bytes)
+    size_t getMemory() const;
+
+private:
+    struct Node {
+        LightBounds bounds;
+        /// Inner node: index of the second child (the first one follows the node). Leaf: primitive
+        uint32_t offset;
+        bool leaf;
+    };
+
+    struct Primitive {
+        LightBounds bounds;
+        Point3f centroid;
+        const Mesh *mesh;
+        uint32_t triangle;
+    };
+
+    /// Build the subtree of the primitives [begin, end), return its node index
+    uint32_t build(std::vector<Primitive> &prims, uint32_t begin, uint32_t end, uint32_t parent, int depth);
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_parent;                         ///< Parent of every node
+    std::vector<Primitive> m_prims;                         ///< In leaf order
+    std::unordered_map<const Mesh *, uint32_t> m_meshOffset; ///< First entry of a mesh in \c m_leaf
+    std::vector<uint32_t> m_leaf;                           ///< Leaf of every emitter triangle
+};
+
+NORI_NAMESPACE_END
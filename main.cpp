@@ -0,0 +1,664 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/timer.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/raybatch.h>
+#include <nori/gui.h>
+#include <nori/cache.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_scheduler_init.h>
+#include <filesystem/resolver.h>
+#include <thread>
+
+using namespace nori;
+
+static int threadCount = -1;
+
+/// Render mode, from the command line
+struct RenderOptions {
+    /// Adaptive sampling: relative error at which a pixel stops (0: off)
+    float adaptiveThreshold = 0.f;
+    /// Progressive rendering: wall-clock budget in seconds (0: none)
+    float timeBudget = 0.f;
+    /// Progressive rendering: RMSE estimate at which to stop (0: none)
+    float targetRMSE = 0.f;
+
+    /// Minimum time between two checkpoints in seconds (negative: no checkpoints)
+    float checkpointInterval = -1.f;
+    /// Continue from the checkpoint of an earlier run
+    bool resume = false;
+
+    bool progressive() const { return timeBudget > 0 || targetRMSE > 0; }
+    bool checkpointed() const { return checkpointInterval >= 0 || resume; }
+};
+
+/**
+ * Running mean and variance of the luminance of the samples of a pixel
+ * (Welford's algorithm), used by the adaptive render mode
+ */
+struct PixelStatistics {
+    uint32_t count = 0;
+    float mean = 0.f, m2 = 0.f;
+
+    void add(float value) {
+        count++;
+        float delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    /**
+     * Standard error of the mean relative to the mean. The small offset
+     * keeps nearly black pixels from asking for samples nobody will see.
+     */
+    float relativeError() const {
+        if (count < 2)
+            return std::numeric_limits<float>::infinity();
+        float variance = m2 / (count - 1);
+        return std::sqrt(variance / count) / (std::abs(mean) + 1e-3f);
+    }
+};
+
+/**
+ * One pass over the image of the adaptive and progressive modes: every
+ * pixel whose relative error is still above \c threshold (all of them for
+ * a threshold of zero) receives \c samples more samples
+ */
+struct RenderPass {
+    uint32_t samples;
+    float threshold;
+    /// Statistics of every pixel of the image, in scanline order
+    std::vector<PixelStatistics> *stats;
+    int width;
+
+    PixelStatistics &get(int x, int y) const { return (*stats)[(size_t) y * width + x]; }
+    bool active(int x, int y) const { return !(get(x, y).relativeError() < threshold); }
+};
+
+/**
+ * Batched version of renderBlock(): every sample index of the block is
+ * one \ref RayBatch with a camera ray per pixel, handed to the integrator
+ * as a whole so that it can run its stages over all of them.
+ */
+static void renderBlockBatch(const Scene *scene, Sampler *sampler, ImageBlock &block, const RenderPass *pass) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+    size_t pixelCount = (size_t) size.x() * (size_t) size.y();
+
+    /* Pixels that take part (all of them, unless they converged in an adaptive render) */
+    std::vector<uint32_t> pixels;
+    pixels.reserve(pixelCount);
+    for (int y=0, k=0; y<size.y(); ++y)
+        for (int x=0; x<size.x(); ++x, ++k)
+            if (!pass || pass->active(x + offset.x(), y + offset.y()))
+                pixels.push_back((uint32_t) k);
+    if (pixels.empty())
+        return;
+
+    RayBatch batch;
+    batch.resize(pixels.size());
+    /* The layout of the tile is only known when it is complete */
+    batch.width = pixels.size() == pixelCount ? (uint32_t) size.x() : 0;
+    std::vector<Point2f> pixelSamples(pixels.size());
+    std::vector<Color3f> cameraWeights(pixels.size());
+
+    uint32_t sampleCount = pass ? pass->samples : (uint32_t) sampler->getSampleCount();
+    for (uint32_t i=0; i<sampleCount; ++i) {
+        /* Generate one camera ray per pixel (sample index i of each of them) */
+        for (size_t k=0, next=0; k<pixelCount; ++k) {
+            sampler->generate();
+            if (next >= pixels.size() || pixels[next] != k)
+                continue;
+            int x = (int) (k % size.x()), y = (int) (k / size.x());
+            pixelSamples[next] = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            Ray3f ray;
+            cameraWeights[next] = camera->sampleRay(ray, pixelSamples[next], apertureSample);
+            batch.rays.set(next, ray);
+            /* The integrator continues this pixel sample from here */
+            batch.samplerStates[next] = sampler->getState();
+            next++;
+        }
+
+        /* Compute the incident radiance along all of them */
+        integrator->LiBatch(scene, sampler, batch);
+
+        /* Store in the image block */
+        for (size_t j=0; j<pixels.size(); ++j) {
+            Color3f value = cameraWeights[j] * batch.Li.get(j);
+            block.put(pixelSamples[j], value);
+            if (pass)
+                pass->get(pixels[j] % size.x() + offset.x(), pixels[j] / size.x() + offset.y()).add(value.getLuminance());
+        }
+    }
+}
+
+/**
+ * Render the pixels of \c block with the sampler's sample count, or,
+ * in an adaptive render, the active pixels with the samples of \c pass
+ */
+static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block, const RenderPass *pass = nullptr) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    if (integrator->supportsBatch()) {
+        renderBlockBatch(scene, sampler, block, pass);
+        return;
+    }
+
+    uint32_t sampleCount = pass ? pass->samples : (uint32_t) sampler->getSampleCount();
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            sampler->generate();
+            PixelStatistics *stats = nullptr;
+            if (pass) {
+                if (!pass->active(x + offset.x(), y + offset.y()))
+                    continue;
+                stats = &pass->get(x + offset.x(), y + offset.y());
+            }
+
+            for (uint32_t i=0; i<sampleCount; ++i) {
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                /* Compute the incident radiance */
+                value *= integrator->Li(scene, sampler, ray);
+
+                /* Store in the image block */
+                block.put(pixelSample, value);
+                if (stats)
+                    stats->add(value.getLuminance());
+
+                sampler->advance();
+            }
+        }
+    }
+}
+
+/**
+ * Render one pass over all the blocks of the image, the pixel samples
+ * numbered from \c firstSample on. The blocks are merged into \c result
+ * in a fixed order once they are all done, so the image does not depend
+ * on the thread scheduling.
+ */
+static void renderPass(Scene *scene, ImageBlock &result, const RenderPass &pass, uint32_t firstSample) {
+    const Camera *camera = scene->getCamera();
+    Vector2i outputSize = camera->getOutputSize();
+    Sampler *sampler = scene->getSampler();
+
+    /* Blocks in scanline order */
+    std::vector<Point2i> offsets;
+    for (int y = 0; y < outputSize.y(); y += NORI_BLOCK_SIZE)
+        for (int x = 0; x < outputSize.x(); x += NORI_BLOCK_SIZE)
+            offsets.push_back(Point2i(x, y));
+    std::vector<std::unique_ptr<ImageBlock>> blocks(offsets.size());
+
+    sampler->setSampleOffset(firstSample);
+    tbb::parallel_for(tbb::blocked_range<int>(0, (int) offsets.size()), [&](const tbb::blocked_range<int> &range) {
+        std::unique_ptr<Sampler> blockSampler(sampler->clone());
+        for (int i=range.begin(); i<range.end(); ++i) {
+            Point2i offset = offsets[i];
+            blocks[i].reset(new ImageBlock(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter()));
+            blocks[i]->setOffset(offset);
+            blocks[i]->setSize(Point2i(std::min(NORI_BLOCK_SIZE, outputSize.x() - offset.x()),
+                std::min(NORI_BLOCK_SIZE, outputSize.y() - offset.y())));
+            blockSampler->prepare(*blocks[i]);
+            renderBlock(scene, blockSampler.get(), *blocks[i], &pass);
+        }
+    });
+    sampler->setSampleOffset(0);
+
+    for (auto &block : blocks)
+        result.put(*block);
+}
+
+/**
+ * Everything a pass-based render (adaptive, progressive or checkpointed)
+ * needs to continue where it stopped. Together with the film, this is
+ * what a checkpoint stores: the samplers restart every block from the
+ * sample offset \c taken, so they need no state of their own.
+ */
+struct RenderState {
+    /// Statistics, and thereby sample count, of every pixel
+    std::vector<PixelStatistics> stats;
+    /// Samples per pixel taken so far (by the pixels still rendering)
+    uint32_t taken = 0;
+    /// Samples per pixel of the next pass (0: the render is complete)
+    uint32_t samples = 0;
+    /// Time spent in the passes so far, in ms
+    double elapsed = 0;
+};
+
+/**
+ * \brief Writes checkpoints of a pass-based render and reads them back
+ *
+ * A checkpoint holds the weighted radiance sums and filter weights of the
+ * film, the pixel statistics and the pass counters. It uses the file
+ * format of the scene cache (see cache.h) keyed by the scene description
+ * and the render mode, and replaces the previous checkpoint atomically,
+ * so a render killed while writing still leaves a valid one.
+ */
+class Checkpointer {
+public:
+    /**
+     * \param interval
+     *    Minimum time between two checkpoints in seconds (0: after every
+     *    pass, negative: never)
+     */
+    Checkpointer(const std::string &filename, uint64_t key, float interval)
+        : m_filename(filename), m_key(key), m_interval(interval) { }
+
+    /// Called after every pass, writes a checkpoint when it is due
+    void pass(const ImageBlock &result, const RenderState &state) {
+        if (m_interval < 0 || (m_timer.elapsed() < m_interval * 1000.0 && state.samples > 0))
+            return;
+        CacheWriter writer(m_filename, m_key);
+        writer.write((uint64_t) result.rows());
+        writer.write((uint64_t) result.cols());
+        writer.write(std::vector<Color4f>(result.data(), result.data() + result.size()));
+        writer.write(state.stats);
+        writer.write(state.taken);
+        writer.write(state.samples);
+        writer.write(state.elapsed);
+        writer.commit();
+        m_timer.reset();
+    }
+
+    /// Restore the film and render state, throws when there is no matching checkpoint
+    void load(ImageBlock &result, RenderState &state) const {
+        CacheReader reader(m_filename, m_key);
+        if (!reader.isValid())
+            throw NoriException("No checkpoint of this scene and render mode found in \"%s\"", m_filename);
+
+        uint64_t rows, cols;
+        std::vector<Color4f> film;
+        reader.read(rows);
+        reader.read(cols);
+        reader.read(film);
+        if (rows != (uint64_t) result.rows() || cols != (uint64_t) result.cols() || film.size() != (size_t) result.size())
+            throw NoriException("The checkpoint \"%s\" has the wrong image size", m_filename);
+        std::copy(film.begin(), film.end(), result.data());
+        reader.read(state.stats);
+        reader.read(state.taken);
+        reader.read(state.samples);
+        reader.read(state.elapsed);
+    }
+
+private:
+    std::string m_filename;
+    uint64_t m_key;
+    float m_interval;
+    Timer m_timer;
+};
+
+/**
+ * Adaptive render mode: the image is rendered in passes over all of its
+ * blocks. The first pass gives every pixel a few samples, each later one
+ * doubles the samples of the pixels whose relative error is still above
+ * \c threshold, until none is left or they reach the sampler's sample
+ * count.
+ *
+ * \param sampleCounts
+ *    Receives the number of samples taken in every pixel
+ */
+static void renderAdaptive(Scene *scene, ImageBlock &result, float threshold, RenderState &state,
+        Checkpointer &checkpointer, Bitmap &sampleCounts) {
+    Vector2i outputSize = scene->getCamera()->getOutputSize();
+    uint32_t maxSamples = std::max((uint32_t) scene->getSampler()->getSampleCount(), 1u);
+    RenderPass pass { state.samples, threshold, &state.stats, outputSize.x() };
+
+    Timer timer;
+    double elapsed = state.elapsed;
+    while (state.samples > 0) {
+        pass.samples = state.samples;
+        renderPass(scene, result, pass, state.taken);
+
+        state.taken += pass.samples;
+        size_t active = 0;
+        for (const PixelStatistics &s : state.stats)
+            active += s.count == state.taken && !(s.relativeError() < threshold);
+        cout << tfm::format("  pass: %i spp per active pixel, %i pixels above the threshold", state.taken, active) << endl;
+
+        state.samples = active > 0 ? std::min(state.taken, maxSamples - state.taken) : 0;
+        state.elapsed = elapsed + timer.elapsed();
+        checkpointer.pass(result, state);
+    }
+
+    sampleCounts = Bitmap(outputSize);
+    size_t total = 0;
+    for (int y = 0; y < outputSize.y(); ++y) {
+        for (int x = 0; x < outputSize.x(); ++x) {
+            uint32_t count = pass.get(x, y).count;
+            sampleCounts.coeffRef(y, x) = Color3f((float) count);
+            total += count;
+        }
+    }
+    cout << tfm::format("Adaptive sampling: %i samples, %.1f spp on average (%i at most); "
+        "a uniform render at equal cost uses sampleCount = %i", total,
+        total / (double) state.stats.size(), maxSamples, (int) std::round(total / (double) state.stats.size())) << endl;
+}
+
+/**
+ * Estimate of the RMSE of the image: root of the mean variance of the pixel
+ * means. Infinite until every pixel has the two samples a variance needs.
+ */
+static float estimateRMSE(const std::vector<PixelStatistics> &stats) {
+    double sum = 0;
+    for (const PixelStatistics &s : stats) {
+        if (s.count < 2)
+            return std::numeric_limits<float>::infinity();
+        sum += s.m2 / ((s.count - 1) * (double) s.count);
+    }
+    return (float) std::sqrt(sum / std::max(stats.size(), (size_t) 1));
+}
+
+/**
+ * Progressive render mode: full-frame passes with 1, 1, 2, 4, ... samples
+ * per pixel, so that the total doubles with every pass. After each pass
+ * the image so far is written to \c outputName (OpenEXR), and the render
+ * stops once the RMSE estimate is below the target or the time budget is
+ * used up; the last pass is shortened to fit into the budget.
+ */
+static void renderProgressive(Scene *scene, ImageBlock &result, const RenderOptions &options, RenderState &state,
+        Checkpointer &checkpointer, const std::string &outputName) {
+    Vector2i outputSize = scene->getCamera()->getOutputSize();
+    RenderPass pass { state.samples, 0.f, &state.stats, outputSize.x() };
+
+    Timer timer;
+    double elapsed = state.elapsed;
+    while (state.samples > 0) {
+        Timer passTimer;
+        pass.samples = state.samples;
+        renderPass(scene, result, pass, state.taken);
+        state.taken += pass.samples;
+        double passTime = passTimer.elapsed();
+
+        /* Checkpoint the image so far */
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        bitmap->saveEXR(outputName);
+
+        float rmse = estimateRMSE(state.stats);
+        cout << tfm::format("  pass: %i spp (%s), RMSE estimate %.5f, total %s", state.taken,
+            timeString(passTime), rmse, timeString(elapsed + timer.elapsed())) << endl;
+
+        uint32_t next = state.taken;
+        if (options.targetRMSE > 0 && rmse < options.targetRMSE)
+            next = 0;
+        if (options.timeBudget > 0) {
+            /* As many samples as fit into the remaining time */
+            double remaining = options.timeBudget * 1000.0 - (elapsed + timer.elapsed());
+            double perSample = std::max(passTime / pass.samples, 1e-3);
+            next = remaining < perSample ? 0 : (uint32_t) std::min((double) next, std::floor(remaining / perSample));
+        }
+        state.samples = next;
+        state.elapsed = elapsed + timer.elapsed();
+        checkpointer.pass(result, state);
+    }
+}
+
+/**
+ * Default render mode with checkpoints: the sampler's sample count is
+ * taken in passes of at most 16 samples per pixel, so that there is a
+ * point to stop at every now and then
+ */
+static void renderCheckpointed(Scene *scene, ImageBlock &result, RenderState &state, Checkpointer &checkpointer) {
+    Vector2i outputSize = scene->getCamera()->getOutputSize();
+    uint32_t maxSamples = std::max((uint32_t) scene->getSampler()->getSampleCount(), 1u);
+    RenderPass pass { state.samples, 0.f, &state.stats, outputSize.x() };
+
+    Timer timer;
+    double elapsed = state.elapsed;
+    while (state.samples > 0) {
+        pass.samples = state.samples;
+        renderPass(scene, result, pass, state.taken);
+        state.taken += pass.samples;
+        cout << tfm::format("  pass: %i/%i spp", state.taken, maxSamples) << endl;
+
+        state.samples = std::min(16u, maxSamples - state.taken);
+        state.elapsed = elapsed + timer.elapsed();
+        checkpointer.pass(result, state);
+    }
+}
+
+/// Default render mode: every block once, with the sampler's sample count
+static void renderBlocks(const Scene *scene, BlockGenerator &blockGenerator, ImageBlock &result) {
+    const Camera *camera = scene->getCamera();
+
+    auto map = [&](const tbb::blocked_range<int> &range) {
+        /* Allocate memory for a small image block that will be rendered
+           by the current thread */
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+            camera->getReconstructionFilter());
+
+        /* Create a clone of the sampler for the current thread */
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+        for (int i=range.begin(); i<range.end(); ++i) {
+            /* Request an image block from the block generator */
+            blockGenerator.next(block);
+
+            /* Inform the sampler about the block to be rendered */
+            sampler->prepare(block);
+
+            /* Render all contained pixels */
+            renderBlock(scene, sampler.get(), block);
+
+            /* The image block has been processed. Now add it to
+               the "big" block that represents the entire image */
+            result.put(block);
+        }
+    };
+
+    /// Default: parallel rendering
+    tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+    tbb::parallel_for(range, map);
+
+    /// (equivalent to the following single-threaded call)
+    // map(range);
+}
+
+static void render(Scene *scene, const std::string &filename, const RenderOptions &options) {
+    const Camera *camera = scene->getCamera();
+    Vector2i outputSize = camera->getOutputSize();
+    scene->getIntegrator()->preprocess(scene);
+
+    /* Create a block generator (i.e. a work scheduler) */
+    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+
+    /* Allocate memory for the entire output image and clear it */
+    ImageBlock result(outputSize, camera->getReconstructionFilter());
+    result.clear();
+
+    /* Samples per pixel, in the adaptive mode */
+    Bitmap sampleCounts;
+
+    /* Determine the filename of the output bitmap */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+
+    /* State of the pass-based modes: a first pass of 16 samples (1 when
+       progressive), or whatever the checkpoint says */
+    RenderState state;
+    state.stats.resize((size_t) outputSize.x() * outputSize.y());
+    state.samples = options.progressive() ? 1 : std::min(16u, std::max((uint32_t) scene->getSampler()->getSampleCount(), 1u));
+
+    uint64_t checkpointKey = CacheHash()
+        .add(scene->toString())
+        .add(options.adaptiveThreshold)
+        .add(options.progressive())
+        .get();
+    Checkpointer checkpointer(outputName + ".checkpoint", checkpointKey, options.checkpointInterval);
+    if (options.resume) {
+        checkpointer.load(result, state);
+        cout << tfm::format("Resuming from \"%s.checkpoint\" at %i spp (%s rendered)", outputName,
+            state.taken, timeString(state.elapsed)) << endl;
+    }
+
+    /* Create a window that visualizes the partially rendered result */
+    nanogui::init();
+    NoriScreen *screen = new NoriScreen(result);
+
+    /* Do the following in parallel and asynchronously */
+    std::thread render_thread([&] {
+        tbb::task_scheduler_init init(threadCount);
+
+        Timer timer;
+        if (options.adaptiveThreshold > 0) {
+            cout << "Rendering adaptively (relative error " << options.adaptiveThreshold << ") .." << endl;
+            renderAdaptive(scene, result, options.adaptiveThreshold, state, checkpointer, sampleCounts);
+        } else if (options.progressive()) {
+            cout << "Rendering progressively .." << endl;
+            renderProgressive(scene, result, options, state, checkpointer, outputName);
+        } else if (options.checkpointed()) {
+            cout << "Rendering with checkpoints .." << endl;
+            renderCheckpointed(scene, result, state, checkpointer);
+        } else {
+            cout << "Rendering .. ";
+            cout.flush();
+            renderBlocks(scene, blockGenerator, result);
+        }
+
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        /* Throughput of the batched shadow ray queries, per thread */
+        if (scene->getOcclusionRayCount() > 0)
+            cout << tfm::format("Occlusion queries: %i rays, %.2f Mrays/s per thread",
+                scene->getOcclusionRayCount(),
+                scene->getOcclusionRayCount() * 1e-6 / std::max(scene->getOcclusionTime(), 1e-9)) << endl;
+    });
+
+    /* Enter the application main loop */
+    nanogui::mainloop();
+
+    /* Shut down the user interface */
+    render_thread.join();
+
+    delete screen;
+    nanogui::shutdown();
+
+    /* Now turn the rendered image block into
+       a properly normalized bitmap */
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+
+    /* Save using the OpenEXR format */
+    bitmap->saveEXR(outputName);
+
+    /* Save tonemapped (sRGB) output using the PNG format */
+    bitmap->savePNG(outputName);
+
+    /* Samples taken in every pixel by the adaptive mode */
+    if (sampleCounts.size() > 0)
+        sampleCounts.saveEXR(outputName + "_spp");
+}
+
+int main(int argc, char **argv) {
+    RenderOptions options;
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        std::string option(argv[arg]);
+        if (option == "--adaptive" && arg + 2 < argc) {
+            options.adaptiveThreshold = toFloat(argv[arg + 1]);
+            arg += 2;
+        } else if (option == "--time" && arg + 2 < argc) {
+            options.timeBudget = toFloat(argv[arg + 1]);
+            arg += 2;
+        } else if (option == "--rmse" && arg + 2 < argc) {
+            options.targetRMSE = toFloat(argv[arg + 1]);
+            arg += 2;
+        } else if (option == "--checkpoint" && arg + 2 < argc) {
+            options.checkpointInterval = std::max(toFloat(argv[arg + 1]), 0.f);
+            arg += 2;
+        } else if (option == "--resume") {
+            options.resume = true;
+            arg += 1;
+        } else {
+            break;
+        }
+    }
+
+    if (options.adaptiveThreshold > 0 && options.progressive()) {
+        cerr << "Fatal error: --adaptive cannot be combined with --time or --rmse" << endl;
+        return -1;
+    }
+
+    if (arg + 1 != argc) {
+        cerr << "Syntax: " << argv[0] << " [--adaptive <relative error> | --time <seconds> | --rmse <error>]"
+             << " [--checkpoint <seconds>] [--resume] <scene.xml>" <<  endl;
+        return -1;
+    }
+
+    filesystem::path path(argv[arg]);
+
+    try {
+        if (path.extension() == "xml") {
+            /* Add the parent directory of the scene file to the
+               file resolver. That way, the XML file can reference
+               resources (OBJ files, textures) using relative paths */
+            getFileResolver()->prepend(path.parent_path());
+
+            std::unique_ptr<NoriObject> root(loadFromXML(argv[arg]));
+
+            /* When the XML root object is a scene, start rendering it .. */
+            if (root->getClassType() == NoriObject::EScene)
+                render(static_cast<Scene *>(root.get()), argv[arg], options);
+        } else if (path.extension() == "exr") {
+            /* Alternatively, provide a basic OpenEXR image viewer */
+            Bitmap bitmap(argv[arg]);
+            ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
+            block.fromBitmap(bitmap);
+            nanogui::init();
+            NoriScreen *screen = new NoriScreen(block);
+            nanogui::mainloop();
+            delete screen;
+            nanogui::shutdown();
+        } else {
+            cerr << "Fatal error: unknown file \"" << argv[arg]
+                 << "\", expected an extension of type .xml or .exr" << endl;
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -22,7 +22,10 @@
 #include <nori/emitter.h>
 #include <nori/warp.h>
 #include <Eigen/Geometry>
-#include <nori/dpdf.h>
+#include <nori/alias.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -39,15 +42,49 @@ void Mesh::activate() {
         m_bsdf = static_cast<BSDF *>(
             NoriObjectFactory::createInstance("diffuse", PropertyList()));
     }
+}
 
-    // Activar DiscretePDF de Nori
-    dpdf.clear();
-    dpdf.reserve(getTriangleCount());
-    for (int i = 0; i < getTriangleCount(); ++i)
-    {
-        dpdf.append(surfaceArea(i));
-    }
-    dpdf.normalize();
+std::vector<float> Mesh::computeTriangleAreas() const {
+    std::vector<float> areas(getTriangleCount());
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, getTriangleCount(), 4096),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i)
+                areas[i] = surfaceArea(i);
+        }
+    );
+    return areas;
+}
+
+void Mesh::setTriangleAreas(std::vector<float> &&areas) {
+    m_areas = std::move(areas);
+}
+
+const AliasTable &Mesh::getSamplingTable() const {
+    std::call_once(m_dpdfOnce, [this]() {
+        // Tabla alias: seleccion de triangulos proporcional al area, construida en el primer uso
+        if (m_areas.size() != getTriangleCount())
+            m_areas = computeTriangleAreas();
+        dpdf.clear();
+        dpdf.reserve(m_areas.size());
+        for (float area : m_areas)
+            dpdf.append(area);
+        dpdf.normalize();
+        std::vector<float>().swap(m_areas);
+        m_dpdfBuilt.store(true, std::memory_order_release);
+    });
+    return dpdf;
+}
+
+float Mesh::getSurfaceArea() const {
+    if (hasSamplingTable())
+        return dpdf.getSum();
+    return (float) tbb::parallel_reduce(tbb::blocked_range<uint32_t>(0, getTriangleCount(), 4096), 0.0,
+        [&](const tbb::blocked_range<uint32_t> &range, double sum) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i)
+                sum += surfaceArea(i);
+            return sum;
+        }, std::plus<double>()
+    );
 }
 
 float Mesh::surfaceArea(uint32_t index) const {
@@ -158,8 +195,9 @@ void Mesh::samplePoint(EmitterQueryRecord& lRec, Point2f& sample) const
 
     // Seleccionar el triangulo con probabilidad proporcional al rea.
     // muestrear dentro del tringulo, reutilizando para un tringulo arbitrario la funcionalidad que se program en Warp::squareToTent()
+    const AliasTable &table = getSamplingTable();
     Point2f pt = Warp::squareToTent(s.x());
-    lRec.pdf = dpdf.getNormalization();
+    lRec.pdf = table.getNormalization();
 
     // Calcular las ponderaciones
     float u = (-pt.y() + 1 - pt.x()) / 2;
@@ -167,7 +205,8 @@ void Mesh::samplePoint(EmitterQueryRecord& lRec, Point2f& sample) const
     float w = pt.y();
 
     // Calcular el punto exacto en el que golpea el rayo
-    int index = dpdf.sampleReuse(s.x());
+    int index = table.sampleReuse(s.x());
+    lRec.triangle = (uint32_t) index;
     Point3f v0 = m_V.col(m_F(0, index));
     Point3f v1 = m_V.col(m_F(1, index));
     Point3f v2 = m_V.col(m_F(2, index));
@@ -188,6 +227,25 @@ void Mesh::samplePoint(EmitterQueryRecord& lRec, Point2f& sample) const
     lRec.n = n;
 }
 
+void Mesh::sampleTriangle(uint32_t index, const Point2f &sample, EmitterQueryRecord &lRec) const {
+    /* Uniform barycentric coordinates */
+    float su = std::sqrt(sample.x());
+    float u = 1.0f - su, v = sample.y() * su, w = 1.0f - u - v;
+
+    Point3f v0 = m_V.col(m_F(0, index));
+    Point3f v1 = m_V.col(m_F(1, index));
+    Point3f v2 = m_V.col(m_F(2, index));
+    lRec.p = v0 * u + v1 * v + v2 * w;
+
+    if (m_N.size() == 0)
+        lRec.n = (v1 - v0).cross(v2 - v0).normalized();
+    else
+        lRec.n = (m_N.col(m_F(0, index)) * u + m_N.col(m_F(1, index)) * v +
+                  m_N.col(m_F(2, index)) * w).normalized();
+    lRec.pdf = 1.0f / surfaceArea(index);
+    lRec.triangle = index;
+}
+
 std::string Intersection::toString() const {
     if (!mesh)
         return "Intersection[invalid]";
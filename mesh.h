@@ -21,7 +21,9 @@
 #include <nori/object.h>
 #include <nori/frame.h>
 #include <nori/bbox.h>
-#include <nori/dpdf.h>
+#include <nori/alias.h>
+#include <atomic>
+#include <mutex>
 
 NORI_NAMESPACE_BEGIN
 
@@ -46,9 +48,11 @@ struct Intersection {
     Frame geoFrame;
     /// Pointer to the associated mesh
     const Mesh *mesh;
+    /// Index of the intersected triangle within \c mesh
+    uint32_t triangle;
 
     /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
+    Intersection() : mesh(nullptr), triangle(0) { }
 
     /// Transform a direction vector into the local shading frame
     Vector3f toLocal(const Vector3f &d) const {
@@ -158,9 +162,42 @@ public:
     /// Return a human-readable summary of this instance
     std::string toString() const;
 
+    /// Compute the area of every triangle (in parallel)
+    std::vector<float> computeTriangleAreas() const;
+
+    /**
+     * \brief Provide the triangle areas (e.g. restored from the scene cache)
+     * that the sampling table will be built from
+     */
+    void setTriangleAreas(std::vector<float> &&areas);
+
+    /**
+     * \brief Return the table that \ref samplePoint() uses to pick a triangle
+     * with probability proportional to its area
+     *
+     * The table is only built the first time it is needed, i.e. only for
+     * meshes with an emitter that actually gets sampled; the emitter power
+     * computed at activation only needs \ref getSurfaceArea(). This is
+     * thread-safe.
+     */
+    const AliasTable &getSamplingTable() const;
+
+    /// Total surface area of the mesh (does not build the sampling table)
+    float getSurfaceArea() const;
+
+    /// Has the sampling table been built yet?
+    bool hasSamplingTable() const { return m_dpdfBuilt.load(std::memory_order_acquire); }
+
     void samplePoint(EmitterQueryRecord& lRec, Point2f& sample) const;
 
-    const float getPDF() const { return dpdf.getNormalization(); }
+    /**
+     * \brief Uniformly sample a point on the triangle \c index
+     *
+     * Sets \c lRec.p, \c lRec.n and the area density \c lRec.pdf
+     */
+    void sampleTriangle(uint32_t index, const Point2f &sample, EmitterQueryRecord &lRec) const;
+
+    const float getPDF() const { return getSamplingTable().getNormalization(); }
 
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
@@ -181,7 +218,10 @@ protected:
     BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
     Emitter    *m_emitter = nullptr;     ///< Associated emitter, if any
     BoundingBox3f m_bbox;                ///< Bounding box of the mesh
-    DiscretePDF dpdf;
+    mutable AliasTable dpdf;             ///< Triangle selection proportional to area (built lazily)
+    mutable std::vector<float> m_areas;  ///< Precomputed triangle areas for the lazy build, if any
+    mutable std::once_flag m_dpdfOnce;   ///< Guards the lazy build of \c dpdf
+    mutable std::atomic<bool> m_dpdfBuilt{false};
 };
 
 NORI_NAMESPACE_END
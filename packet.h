@@ -0,0 +1,100 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/raybatch.h>
+
+/// Packet width used to split ray streams into packets
+#define NORI_PACKET_SIZE 8
+
+/// Marks a lane or a stream entry that did not hit anything
+#define NORI_INVALID_PRIM ((uint32_t) -1)
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Fixed-size packet of \c N rays stored as structure-of-arrays
+ *
+ * All the lane loops over these arrays have a compile-time trip count and
+ * no dependencies between lanes, so they compile to SIMD code. Supported
+ * widths are 4, 8 and 16.
+ */
+template <int N> struct RayPacket {
+    static_assert(N == 4 || N == 8 || N == 16, "RayPacket: unsupported width");
+
+    /* Inactive lanes are still computed (and ignored), so keep them initialized */
+    alignas(64) float ox[N] = {}, oy[N] = {}, oz[N] = {};
+    alignas(64) float dx[N] = {}, dy[N] = {}, dz[N] = {};
+    /// Reciprocal of the direction, used by the box tests
+    alignas(64) float rdx[N] = {}, rdy[N] = {}, rdz[N] = {};
+    alignas(64) float mint[N] = {}, maxt[N] = {};
+    /// Bit \c i is set when lane \c i holds a valid ray
+    uint32_t active = 0;
+
+    /// Store \c ray in lane \c i and activate it
+    void set(int i, const Ray3f &ray) {
+        ox[i] = ray.o.x(); oy[i] = ray.o.y(); oz[i] = ray.o.z();
+        dx[i] = ray.d.x(); dy[i] = ray.d.y(); dz[i] = ray.d.z();
+        rdx[i] = ray.dRcp.x(); rdy[i] = ray.dRcp.y(); rdz[i] = ray.dRcp.z();
+        mint[i] = ray.mint; maxt[i] = ray.maxt;
+        active |= 1u << i;
+    }
+
+    /// Copy entry \c j of a ray stream into lane \c i and activate it
+    void set(int i, const RayQueue &rays, size_t j) {
+        ox[i] = rays.ox[j]; oy[i] = rays.oy[j]; oz[i] = rays.oz[j];
+        dx[i] = rays.dx[j]; dy[i] = rays.dy[j]; dz[i] = rays.dz[j];
+        rdx[i] = 1.f / dx[i]; rdy[i] = 1.f / dy[i]; rdz[i] = 1.f / dz[i];
+        mint[i] = rays.mint[j]; maxt[i] = rays.maxt[j];
+        active |= 1u << i;
+    }
+
+    /// Reassemble the ray stored in lane \c i
+    Ray3f get(int i) const {
+        return Ray3f(Point3f(ox[i], oy[i], oz[i]), Vector3f(dx[i], dy[i], dz[i]), mint[i], maxt[i]);
+    }
+};
+
+/// Closest hits (or occlusion flags) found for a \ref RayPacket
+template <int N> struct PacketHit {
+    alignas(64) float t[N], u[N], v[N];
+    /// Primitive that was hit (see \ref Accel::fillIntersection()), or \c NORI_INVALID_PRIM
+    uint32_t prim[N];
+
+    void reset() {
+        for (int i = 0; i < N; ++i)
+            prim[i] = NORI_INVALID_PRIM;
+    }
+
+    bool hit(int i) const { return prim[i] != NORI_INVALID_PRIM; }
+};
+
+/// Hits found for a stream of rays (\ref RayQueue), structure-of-arrays
+struct HitQueue {
+    std::vector<float> t, u, v;
+    std::vector<uint32_t> prim;
+
+    size_t size() const { return prim.size(); }
+
+    void resize(size_t size) { t.resize(size); u.resize(size); v.resize(size); prim.resize(size); }
+
+    bool hit(size_t i) const { return prim[i] != NORI_INVALID_PRIM; }
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,193 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Stand-alone benchmark (like warptest): compares the throughput of the
+    single-ray Scene::rayIntersect queries against the 4/8/16-wide packet
+    and stream queries on primary rays, and the Scene::rayOccluded any-hit
+    queries (reported as occlusion rays/s) on NEE shadow rays.
+
+    Syntax: packetbench <scene.xml> [repetitions]
+*/
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+
+using namespace nori;
+
+/**
+ * Generate the rays in 4x4 pixel tiles, Morton ordered inside each tile,
+ * so that packets of 4, 8 and 16 consecutive rays cover 2x2, 4x2 and 4x4
+ * pixels respectively
+ */
+static std::vector<Ray3f> primaryRays(const Camera *camera) {
+    Vector2i size = camera->getOutputSize();
+    std::vector<Ray3f> rays;
+    rays.reserve((size_t) size.x() * size.y());
+
+    for (int ty = 0; ty < size.y(); ty += 4) {
+        for (int tx = 0; tx < size.x(); tx += 4) {
+            for (int m = 0; m < 16; ++m) {
+                int x = tx + ((m & 1) | ((m >> 1) & 2));
+                int y = ty + (((m >> 1) & 1) | ((m >> 2) & 2));
+                if (x >= size.x() || y >= size.y())
+                    continue;
+                Ray3f ray;
+                camera->sampleRay(ray, Point2f(x + 0.5f, y + 0.5f), Point2f(0.5f));
+                rays.push_back(ray);
+            }
+        }
+    }
+    return rays;
+}
+
+/// One NEE shadow ray per primary hit, in the same (coherent) order
+static std::vector<Ray3f> shadowRays(const Scene *scene, const std::vector<Ray3f> &primary) {
+    std::vector<Ray3f> rays;
+    if (scene->getEmitters().empty())
+        return rays;
+
+    pcg32 rng;
+    for (const Ray3f &ray : primary) {
+        Intersection its;
+        if (!scene->rayIntersect(ray, its) || its.mesh->isEmitter())
+            continue;
+        EmitterQueryRecord lRec(its.p);
+        scene->sampleEmitterUnshadowed(lRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+        rays.push_back(Ray3f(lRec.ref, lRec.wi, Epsilon, (lRec.p - lRec.ref).norm() - Epsilon));
+    }
+    return rays;
+}
+
+static size_t traceSingle(const Scene *scene, const std::vector<Ray3f> &rays, bool shadowRay) {
+    size_t hits = 0;
+    Intersection its;
+    for (const Ray3f &ray : rays)
+        hits += shadowRay ? scene->rayOccluded(ray) : scene->rayIntersect(ray, its);
+    return hits;
+}
+
+template <int N> static size_t tracePacket(const Scene *scene, const std::vector<Ray3f> &rays, bool shadowRay) {
+    size_t hits = 0;
+    RayPacket<N> packet;
+    PacketHit<N> hit;
+    for (size_t begin = 0; begin < rays.size(); begin += N) {
+        int count = (int) std::min(rays.size() - begin, (size_t) N);
+        packet.active = 0;
+        for (int i = 0; i < count; ++i)
+            packet.set(i, rays[begin + i]);
+        if (shadowRay) {
+            uint32_t mask = scene->rayOccluded(packet);
+            for (int i = 0; i < count; ++i)
+                hits += (mask >> i) & 1;
+        } else {
+            scene->rayIntersect(packet, hit);
+            for (int i = 0; i < count; ++i)
+                hits += hit.hit(i);
+        }
+    }
+    return hits;
+}
+
+static size_t traceStream(const Scene *scene, const RayQueue &rays, bool shadowRay) {
+    size_t count = 0;
+    if (shadowRay) {
+        std::vector<uint8_t> occluded;
+        scene->rayOccluded(rays, occluded);
+        for (uint8_t o : occluded)
+            count += o;
+    } else {
+        HitQueue hits;
+        scene->rayIntersect(rays, hits);
+        for (size_t i = 0; i < hits.size(); ++i)
+            count += hits.hit(i);
+    }
+    return count;
+}
+
+/// Run \c trace \c repetitions times and print its throughput
+template <typename Func> static void measure(const std::string &name, const char *unit,
+        size_t rayCount, int repetitions, size_t expectedHits, const Func &trace) {
+    size_t hits = 0;
+    Timer timer;
+    for (int i = 0; i < repetitions; ++i)
+        hits = trace();
+    double ms = timer.elapsed();
+    double mrays = ms > 0 ? (double) rayCount * repetitions / (ms * 1000.0) : 0.0;
+
+    cout << tfm::format("  %-10s %9.2f %s  (%s, %i hits%s)", name, mrays, unit,
+        timeString(ms / repetitions, true), hits,
+        hits == expectedHits ? "" : " MISMATCH") << endl;
+}
+
+static void benchmark(const Scene *scene, const std::string &workload,
+        const std::vector<Ray3f> &rays, bool shadowRay, int repetitions) {
+    RayQueue queue;
+    queue.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+        queue.set(i, rays[i]);
+
+    /* Reference: closest-hit traversal, also for the shadow rays */
+    size_t expected = 0;
+    Intersection its;
+    for (const Ray3f &ray : rays)
+        expected += scene->rayIntersect(ray, its);
+
+    /* Shadow rays go through the any-hit queries, reported as occlusion rays/s */
+    const char *unit = shadowRay ? "Mocclusion rays/s" : "Mrays/s";
+
+    cout << workload << ": " << rays.size() << " rays" << endl;
+    if (shadowRay)
+        measure("closest", "Mrays/s", rays.size(), repetitions, expected, [&] { return traceSingle(scene, rays, false); });
+    measure("single", unit, rays.size(), repetitions, expected, [&] { return traceSingle(scene, rays, shadowRay); });
+    measure("packet4", unit, rays.size(), repetitions, expected, [&] { return tracePacket<4>(scene, rays, shadowRay); });
+    measure("packet8", unit, rays.size(), repetitions, expected, [&] { return tracePacket<8>(scene, rays, shadowRay); });
+    measure("packet16", unit, rays.size(), repetitions, expected, [&] { return tracePacket<16>(scene, rays, shadowRay); });
+    measure("stream", unit, rays.size(), repetitions, expected, [&] { return traceStream(scene, queue, shadowRay); });
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [repetitions]" << endl;
+        return -1;
+    }
+    int repetitions = argc > 2 ? std::max(toInt(argv[2]), 1) : 5;
+
+    try {
+        filesystem::path path(argv[1]);
+        getFileResolver()->prepend(path.parent_path());
+
+        std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+        if (root->getClassType() != NoriObject::EScene)
+            throw NoriException("\"%s\" does not describe a scene", argv[1]);
+        const Scene *scene = static_cast<const Scene *>(root.get());
+
+        std::vector<Ray3f> primary = primaryRays(scene->getCamera());
+        benchmark(scene, "Primary rays (closest hit)", primary, false, repetitions);
+        benchmark(scene, "Shadow rays (occlusion)", shadowRays(scene, primary), true, repetitions);
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+	Path tracing with path guiding (SD-tree learnt in training passes)
+*/
+
+#include <nori/pathtracer.h>
+#include <nori/sdtree.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Paths of "pathtracer_nee"; the continuations are sampled through a \ref PathHook
+typedef PathPolicy<true, EMISHeuristic::EBalance, ERussianRoulette::ELuminance, MAX_PATH_LENGTH> PathGuidedPolicy;
+
+/**
+ * \brief Path tracer that guides its continuation directions
+ *
+ * The paths of "pathtracer_nee" (the shared \ref PathKernel, next event
+ * estimation with the balance heuristic), but at every non-specular vertex
+ * the next direction is drawn either from the BSDF (with probability
+ * \c bsdfFraction) or from the incident radiance learnt at that point of
+ * the scene, and weighted by the density of the mixture (one-sample MIS),
+ * through the \ref PathHook continuation sampling. The incident radiance is stored in an
+ * \ref SDTree and learnt in \ref preprocess(), before the render: training
+ * pass k traces \c trainingSamples * 2^k paths per pixel, guided by what
+ * the previous passes learnt, and records the radiance that every vertex
+ * receives along its sampled direction. There are \c trainingPasses of
+ * them, or fewer if \c trainingBudget seconds run out first; the render
+ * itself then takes the sampler's samples with the final, frozen tree.
+ */
+class PathGuided : public Integrator, public PathHook {
+public:
+    PathGuided(const PropertyList &props) {
+        m_trainingPasses = std::max(props.getInteger("trainingPasses", 5), 0);
+        m_trainingSamples = std::max(props.getInteger("trainingSamples", 1), 1);
+        m_trainingBudget = props.getFloat("trainingBudget", 0.f);
+        m_bsdfFraction = std::min(std::max(props.getFloat("bsdfFraction", 0.5f), 0.f), 1.f);
+        m_spatialThreshold = std::max(props.getInteger("spatialThreshold", 12000), 1);
+        m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+        m_maxDirectionalDepth = std::max(props.getInteger("maxDirectionalDepth", 20), 1);
+    }
+
+    void preprocess(const Scene *scene) {
+        m_tree.reset(new SDTree(scene->getBoundingBox()));
+
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+        Timer timer;
+        float lastPass = 0.f;
+        for (int pass = 0; pass < m_trainingPasses; ++pass) {
+            /* Each pass traces twice the paths of the previous one: stop
+               before a pass that would overrun the budget */
+            float start = timer.elapsed();
+            if (m_trainingBudget > 0 && start + 2.f * lastPass > m_trainingBudget * 1000.f)
+                break;
+
+            /* One training pass over the image; the radiance estimates are only used for learning */
+            uint32_t spp = (uint32_t) m_trainingSamples << pass;
+            tbb::parallel_for(tbb::blocked_range<int>(0, size.y()), [&](const tbb::blocked_range<int> &range) {
+                for (int y = range.begin(); y < range.end(); ++y) {
+                    std::unique_ptr<Sampler> sampler = createIndependentSampler(((uint64_t) pass << 32) | (uint64_t) y);
+                    for (int x = 0; x < size.x(); ++x) {
+                        for (uint32_t i = 0; i < spp; ++i) {
+                            Ray3f ray;
+                            Point2f pixelSample = Point2f((float) x, (float) y) + sampler->next2D();
+                            Color3f weight = camera->sampleRay(ray, pixelSample, sampler->next2D());
+                            if (!weight.isZero())
+                                trace(scene, sampler.get(), ray, true);
+                        }
+                    }
+                }
+            });
+
+            m_tree->refine((uint32_t) (m_spatialThreshold * std::sqrt((float) spp)),
+                m_directionalThreshold, m_maxDirectionalDepth);
+            cout << tfm::format("Path guiding: training pass %i (%i spp), %i spatial leaves, %i directional nodes, %s",
+                pass + 1, spp, m_tree->getLeafCount(), m_tree->getDirectionalNodeCount(),
+                timer.elapsedString()) << endl;
+            lastPass = timer.elapsed() - start;
+        }
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        return trace(scene, sampler, ray, false);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "PathGuided[\n"
+            "  trainingPasses = %i,\n"
+            "  trainingSamples = %i,\n"
+            "  trainingBudget = %f,\n"
+            "  bsdfFraction = %f,\n"
+            "  spatialThreshold = %i,\n"
+            "  directionalThreshold = %f,\n"
+            "  maxDirectionalDepth = %i\n"
+            "]",
+            m_trainingPasses, m_trainingSamples, m_trainingBudget, m_bsdfFraction,
+            m_spatialThreshold, m_directionalThreshold, m_maxDirectionalDepth
+        );
+    }
+
+    /// Continuation from the BSDF or the guiding distribution, one-sample MIS
+    Color3f sampleContinuation(const Intersection &its, const BSDF *bsdf, BSDFQueryRecord &bRec,
+            Sampler *sampler, float &pdf) const {
+        const SDTree::Leaf *leaf = guidingLeaf(its, bsdf);
+        float bsdfFraction = leaf ? m_bsdfFraction : 1.f;
+        Color3f weight(0.f);
+        pdf = 0.f;
+        float choice = sampler->next1D();
+        Point2f sample = sampler->next2D();
+        if (choice < bsdfFraction) {
+            weight = bsdf->sample(bRec, sample);
+            if (bRec.measure != EDiscrete) {
+                float bsdfPdf = bsdf->pdf(bRec);
+                pdf = mixturePdf(its, bsdf, leaf, bsdfFraction, bRec);
+                weight = pdf > 0.f ? weight * (bsdfPdf / pdf) : Color3f(0.f);
+            }
+        } else {
+            bRec.wo = its.toLocal(leaf->sampling.sample(sample));
+            bRec.measure = ESolidAngle;
+            pdf = mixturePdf(its, bsdf, leaf, bsdfFraction, bRec);
+            if (pdf > 0.f)
+                weight = bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo)) / pdf;
+        }
+        return weight;
+    }
+
+    float pdfContinuation(const Intersection &its, const BSDF *bsdf, const BSDFQueryRecord &bRec) const {
+        const SDTree::Leaf *leaf = guidingLeaf(its, bsdf);
+        return mixturePdf(its, bsdf, leaf, leaf ? m_bsdfFraction : 1.f, bRec);
+    }
+
+    /// Radiance per unit of sampling density, for the quadtrees
+    void recordContinuation(const Point3f &p, const Vector3f &d, float pdf, const Color3f &radiance) const {
+        m_tree->lookup(p).record(d, radiance.getLuminance() / pdf);
+    }
+
+private:
+    /**
+     * \brief Estimate the radiance along \c ray
+     *
+     * \param record
+     *    Add the incident radiance found at every non-specular vertex to
+     *    the distributions being learnt
+     */
+    Color3f trace(const Scene *scene, Sampler *sampler, const Ray3f &ray, bool record) const {
+        uint64_t reusedHits = 0;
+        PathOptions options;
+        options.hook = this;
+        options.recordContinuations = record;
+        return PathKernel<PathGuidedPolicy>::Li(scene, sampler, ray, reusedHits, options);
+    }
+
+    /// Guiding distribution of \c its, if the BSDF has a non-specular part and something was learnt there
+    const SDTree::Leaf *guidingLeaf(const Intersection &its, const BSDF *bsdf) const {
+        if (!bsdf->isDiffuse())
+            return nullptr;
+        const SDTree::Leaf *leaf = &m_tree->lookup(its.p);
+        return leaf->sampling.getTotal() > 0.f ? leaf : nullptr;
+    }
+
+    /// Density of the mixture of the BSDF (weight \c bsdfFraction) and the guiding distribution
+    float mixturePdf(const Intersection &its, const BSDF *bsdf, const SDTree::Leaf *leaf, float bsdfFraction,
+            const BSDFQueryRecord &bRec) const {
+        float pdf = bsdfFraction * bsdf->pdf(bRec);
+        if (leaf)
+            pdf += (1.f - bsdfFraction) * leaf->sampling.pdf(its.toWorld(bRec.wo));
+        return pdf;
+    }
+
+    int m_trainingPasses;
+    int m_trainingSamples;
+    float m_trainingBudget;
+    float m_bsdfFraction;
+    int m_spatialThreshold;
+    float m_directionalThreshold;
+    int m_maxDirectionalDepth;
+
+    std::unique_ptr<SDTree> m_tree;
+};
+
+NORI_REGISTER_CLASS(PathGuided, "path_guided");
+NORI_NAMESPACE_END
@@ -1,126 +1,20 @@
-#include <nori/integrator.h>
-#include <nori/scene.h>
-#include <nori/bsdf.h>
-#include <nori/sampler.h>
-#include <nori/emitter.h>
-#include <nori/camera.h>
-#include <nori/warp.h>
-
-#define MAX_PATH_LENGTH 128
+#include <nori/pathtracer.h>
 
 NORI_NAMESPACE_BEGIN
 
-class PathTracingNEEDOF : public Integrator {
-
-	struct PathInfo {
-	public:
-		unsigned int depth;
-		Color3f pathThroughput; // la acomulacin de G(diapo 23 PathTracing)
-		/// Return a human-readable string summary
-		std::string toString() const {
-			return tfm::format("[%d, %f, %f, %f]", depth, pathThroughput[0], pathThroughput[1], pathThroughput[2]);
-		}
-	};
+/**
+ * Same estimator as "pathtracer_nee". Depth of field now comes from the
+ * thin lens of the camera (apertureSize, focalDistance) with every
+ * integrator, at no extra cost per pixel sample; the name is kept so that
+ * existing scenes still load.
+ */
+typedef PathPolicy<true, EMISHeuristic::EBalance, ERussianRoulette::ELuminance, MAX_PATH_LENGTH> PathTracingNEEDOFPolicy;
 
+class PathTracingNEEDOF : public PathIntegrator<PathTracingNEEDOFPolicy> {
 public:
-	PathTracingNEEDOF(const PropertyList& props) {} 
-
-	Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const {
-		const Camera* cam = scene->getCamera();
-		Point3f focalPoint = ray.o + ray.d * cam->getFocalDistance();
-		float aperture = cam->getApertureSize();
-		Color3f averageLi(0.0f);
-		int dofSamples = cam->getDofSamples();
-
-		for (int i = 0; i < dofSamples; i++) {
-			Point2f offset = sampler->next2D();
-			offset = Warp::squareToUniformDisk(offset);
-			offset *= aperture;
-			Point3f newOrigin = ray.o + Point3f(offset.x(), offset.y(), 0.0f);
-			Ray3f shiftedRay(newOrigin, (focalPoint - newOrigin).normalized());
-
-			PathInfo pathInfo;
-			pathInfo.depth = 0;
-			pathInfo.pathThroughput.setOnes();
-			averageLi += LiRecursive(scene, sampler, shiftedRay, pathInfo);
-		}
-		
-		
-		return averageLi / dofSamples;
-		}
-
-	Color3f LiRecursive(const Scene* scene, Sampler* sampler, const Ray3f& ray, PathInfo& pathInfo) const {
-		Color3f myLi = Color3f(0.f);
-		Intersection its;
-		// calcular myLi: es lo que vale la luz en un vertice
-
-		if (pathInfo.depth >= MAX_PATH_LENGTH)
-			return myLi;
-
-		if (!scene->rayIntersect(ray, its))
-			return myLi;
-
-		// Ruleta rusa
-		float probRR = std::min(pathInfo.pathThroughput.getLuminance(), 1.0f);
-		if (sampler->next1D() >= probRR)
-			return myLi;
-		pathInfo.pathThroughput /= probRR;
-
-		if (its.mesh->isEmitter()) {
-			EmitterQueryRecord eQR(ray.o, its.p, its.shFrame.n);
-			return its.mesh->getEmitter()->eval(eQR) * pathInfo.pathThroughput;
-		}
-
-		//EMS
-		EmitterQueryRecord lRec(its.p);
-		Color3f lRef = scene->sampleEmitter(lRec, sampler->next2D());
-		float lR_pdf = lRec.pdf;
-
-		BSDFQueryRecord bsdfQR_EMS = BSDFQueryRecord(its.toLocal(-ray.d), its.toLocal(lRec.wi), ESolidAngle);
-		Color3f bsdfColor = its.mesh->getBSDF()->eval(bsdfQR_EMS);
-		float bsdf_pdf = its.mesh->getBSDF()->pdf(bsdfQR_EMS);
-
-		float cosTheta = Frame::cosTheta(its.shFrame.toLocal(lRec.wi));
-
-		float w_ems = bsdf_pdf + lR_pdf > 0.f ? lR_pdf / (bsdf_pdf + lR_pdf) : lR_pdf;
-
-		Color3f ems = lRef * bsdfColor * cosTheta * pathInfo.pathThroughput;
-
-		//BSDF
-		BSDFQueryRecord bsdfQR(its.toLocal(-ray.d));
-		Color3f fr = its.mesh->getBSDF()->sample(bsdfQR, sampler->next2D());
-		float pdf_mat = its.mesh->getBSDF()->pdf(bsdfQR);
-
-		if (bsdfQR.measure == EDiscrete)
-			pdf_mat = 1.0f;
-
-		pathInfo.pathThroughput *= fr;
-
-		// recursive
-		Ray3f rRay = Ray3f(its.p, its.toWorld(bsdfQR.wo));
-		pathInfo.depth++;
-
-		Point3f origin = its.p;
-
-		float pdf_em = 0.f;
-		if (scene->rayIntersect(rRay, its) && its.mesh->isEmitter()) {
-			EmitterQueryRecord leEmitterQR(origin, its.p, its.shFrame.n);
-			pdf_em = its.mesh->getEmitter()->pdf(leEmitterQR);
-		}
-		float w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
-
-		return (LiRecursive(scene, sampler, rRay, pathInfo) * w_mats + ems * w_ems); // = myLi
-
-
-	}
-
-	std::string toString() const {
-		return "PathTracingNEEDOF[]";
-	}
+	PathTracingNEEDOF(const PropertyList& props) : PathIntegrator("PathTracingNEEDOF", props) {}
 };
 
 
 NORI_REGISTER_CLASS(PathTracingNEEDOF, "pathtracer_nee_dof");
 NORI_NAMESPACE_END
-
-
@@ -0,0 +1,714 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+#include <nori/camera.h>
+#include <nori/radiancecache.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <atomic>
+
+#define MAX_PATH_LENGTH 128
+
+NORI_NAMESPACE_BEGIN
+
+/// Weighting used to combine emitter samples and BSDF samples
+enum class EMISHeuristic {
+    /// No MIS: emitter sampling only accounts for direct light (needs NEE)
+    ENone = 0,
+    /// Balance heuristic
+    EBalance,
+    /// Power heuristic (beta = 2)
+    EPower
+};
+
+/// Strategy used to terminate paths
+enum class ERussianRoulette {
+    /// Paths only stop at \c MaxDepth or when they leave the scene
+    ENone = 0,
+    /// Survival probability min(luminance(throughput), 1)
+    ELuminance
+};
+
+/**
+ * \brief Compile-time configuration of the shared path tracing kernel
+ *
+ * \tparam NEE
+ *    Sample an emitter at every vertex (next event estimation)
+ * \tparam MIS
+ *    How emitter samples and BSDF-sampled emitter hits are weighted.
+ *    Ignored when \c NEE is \c false.
+ * \tparam RR
+ *    Russian roulette strategy
+ * \tparam MaxDepth
+ *    Maximum number of scattering events. Emission found by the
+ *    last continuation ray is still accounted for.
+ *
+ * Depth of field is left to the camera (see the thin lens of
+ * perspective.cpp), so it works the same with every policy.
+ */
+template <bool _NEE, EMISHeuristic _MIS, ERussianRoulette _RR, int _MaxDepth>
+struct PathPolicy {
+    static constexpr bool NEE = _NEE;
+    static constexpr EMISHeuristic MIS = _NEE ? _MIS : EMISHeuristic::ENone;
+    static constexpr ERussianRoulette RR = _RR;
+    static constexpr int MaxDepth = _MaxDepth;
+};
+
+/// MIS weight of a sample drawn with density \c pdfA against strategy \c pdfB
+template <EMISHeuristic H> inline float misWeight(float pdfA, float pdfB) {
+    if (H == EMISHeuristic::EPower) {
+        pdfA *= pdfA;
+        pdfB *= pdfB;
+    }
+    return pdfA + pdfB > 0.f ? pdfA / (pdfA + pdfB) : pdfA;
+}
+
+/// Counters of the path kernels, summed into \ref PathIntegrator's statistics
+struct PathCounters {
+    /// Path vertices (intersections) shaded
+    uint64_t vertices = 0;
+    /// Additional paths created by splitting
+    uint64_t splits = 0;
+    /// Paths ended by a radiance cache lookup
+    uint64_t cacheHits = 0;
+};
+
+/// Vertices of a training path of \ref EfficiencyRR
+struct PathRecord {
+    int count = 0;
+    /// Depth, throughput luminance and radiance luminance found before each (non-emitter) vertex
+    int depth[MAX_PATH_LENGTH];
+    float throughput[MAX_PATH_LENGTH];
+    float before[MAX_PATH_LENGTH];
+
+    void add(int d, float t, float b) {
+        if (count < MAX_PATH_LENGTH) {
+            depth[count] = d;
+            throughput[count] = t;
+            before[count] = b;
+            count++;
+        }
+    }
+};
+
+/**
+ * \brief Efficiency-aware russian roulette and splitting
+ *
+ * After Rath et al., "EARS: Efficiency-Aware Russian Roulette and
+ * Splitting" (2022). A vertex at depth d with throughput T is continued
+ *
+ *     q = lum(T) * sqrt(M_d / C_d) / sqrt(V / C)
+ *
+ * times, where M_d is the second moment of the luminance of the radiance a
+ * path collects from depth d on, C_d the cost (vertices) of doing so, V the
+ * variance of one sample of a pixel and C the cost of that sample: the
+ * factor that maximizes the efficiency (inverse of variance x time). q < 1
+ * is a survival probability, q > 1 a number of copies rounded
+ * stochastically, each weighted by 1/q. q is clamped to [0.05, maxSplit].
+ *
+ * EARS learns these quantities per region of the scene; here they are per
+ * depth over the whole image, from a short training render (see
+ * \ref PathIntegrator::preprocess()). Depths with too few training vertices
+ * fall back to the luminance roulette.
+ */
+class EfficiencyRR {
+public:
+    /// Sums gathered by the training paths
+    struct Statistics {
+        /// Per depth: sum of squared radiance luminances, of costs, number of vertices
+        std::vector<double> moment2, cost;
+        std::vector<uint64_t> count;
+        /// Sum of per-pixel sample variances, number of pixels, sum of path costs, number of paths
+        double variance = 0, pixelCost = 0;
+        uint64_t pixels = 0, paths = 0;
+
+        /// Add a training path with \c vertices vertices whose radiance luminance is \c total
+        void addPath(const PathRecord &record, float total, uint64_t vertices) {
+            for (int i = 0; i < record.count; ++i) {
+                size_t d = (size_t) record.depth[i];
+                if (!(record.throughput[i] > 0.f))
+                    continue;
+                if (moment2.size() <= d) {
+                    moment2.resize(d + 1, 0.0);
+                    cost.resize(d + 1, 0.0);
+                    count.resize(d + 1, 0);
+                }
+                double Lr = (total - record.before[i]) / record.throughput[i];
+                moment2[d] += Lr * Lr;
+                cost[d] += (double) vertices - (double) d;
+                count[d]++;
+            }
+            pixelCost += (double) vertices;
+            paths++;
+        }
+
+        void merge(const Statistics &other) {
+            if (moment2.size() < other.moment2.size()) {
+                moment2.resize(other.moment2.size(), 0.0);
+                cost.resize(other.moment2.size(), 0.0);
+                count.resize(other.moment2.size(), 0);
+            }
+            for (size_t d = 0; d < other.moment2.size(); ++d) {
+                moment2[d] += other.moment2[d];
+                cost[d] += other.cost[d];
+                count[d] += other.count[d];
+            }
+            variance += other.variance;
+            pixelCost += other.pixelCost;
+            pixels += other.pixels;
+            paths += other.paths;
+        }
+    };
+
+    EfficiencyRR(float maxSplit = 8.f) : m_maxSplit(maxSplit) { }
+
+    /// Compute the factors of every depth from the training statistics
+    void build(const Statistics &stats) {
+        m_factor.assign(stats.moment2.size(), -1.f);
+        double V = stats.pixels > 0 ? stats.variance / stats.pixels : 0.0;
+        double C = stats.paths > 0 ? stats.pixelCost / stats.paths : 0.0;
+        if (!(V > 0) || !(C > 0))
+            return;
+        for (size_t d = 0; d < m_factor.size(); ++d) {
+            if (stats.count[d] < 16)
+                continue;
+            double M = stats.moment2[d] / stats.count[d], Cd = stats.cost[d] / stats.count[d];
+            m_factor[d] = (float) (std::sqrt(M / std::max(Cd, 1.0)) / std::sqrt(V / C));
+        }
+    }
+
+    /// Continuation factor of a vertex at \c depth with throughput luminance \c throughput (0: unknown)
+    float factor(int depth, float throughput) const {
+        if (depth >= (int) m_factor.size() || m_factor[depth] < 0.f)
+            return 0.f;
+        return std::min(std::max(throughput * m_factor[depth], 0.05f), m_maxSplit);
+    }
+
+    float getMaxSplit() const { return m_maxSplit; }
+
+    /// Number of depths with a factor
+    int getDepthCount() const {
+        return (int) std::count_if(m_factor.begin(), m_factor.end(), [](float f) { return f >= 0.f; });
+    }
+
+private:
+    float m_maxSplit;
+    std::vector<float> m_factor;
+};
+
+/**
+ * \brief Run-time extension of \ref PathKernel for integrators that add a
+ * radiance estimate of their own (such as the caustic photon map) or sample
+ * the continuation of the paths themselves (such as path guiding)
+ */
+class PathHook {
+public:
+    virtual ~PathHook() { }
+
+    /**
+     * \brief Radiance reflected at the non-specular vertex \c its towards
+     * \c wi (local) that the path does not find by itself
+     */
+    virtual Color3f vertexRadiance(const Intersection &its, const BSDF *bsdf, const Vector3f &wi) const {
+        return Color3f(0.f);
+    }
+
+    /**
+     * \brief Does \ref vertexRadiance() include the light of emitters seen
+     * from a non-specular vertex through specular bounces only (caustics)?
+     * The kernel then ignores these emitter hits.
+     */
+    virtual bool coversCaustics() const { return false; }
+
+    /**
+     * \brief Sample the direction \c bRec.wo in which the path continues
+     * from \c its (\c bRec.wi is set)
+     *
+     * \param pdf
+     *    Solid angle density of the direction, used by the MIS weights of
+     *    the emitter hits (unused for \c EDiscrete samples)
+     * \return
+     *    BSDF value x cosine / density
+     */
+    virtual Color3f sampleContinuation(const Intersection &its, const BSDF *bsdf, BSDFQueryRecord &bRec,
+            Sampler *sampler, float &pdf) const {
+        Color3f weight = bsdf->sample(bRec, sampler->next2D());
+        pdf = bRec.measure == EDiscrete ? 0.f : bsdf->pdf(bRec);
+        return weight;
+    }
+
+    /// Density with which \ref sampleContinuation() picks \c bRec.wo, for the MIS weights of emitter samples
+    virtual float pdfContinuation(const Intersection &its, const BSDF *bsdf, const BSDFQueryRecord &bRec) const {
+        return bsdf->pdf(bRec);
+    }
+
+    /**
+     * \brief Radiance found along the direction \c d (world space) sampled
+     * with density \c pdf at the non-specular vertex \c p, once the path
+     * has ended (with \ref PathOptions::recordContinuations)
+     */
+    virtual void recordContinuation(const Point3f &p, const Vector3f &d, float pdf, const Color3f &radiance) const { }
+};
+
+/// Optional extensions of \ref PathKernel::Li()
+struct PathOptions {
+    /// Vertex and split counters
+    PathCounters *counters = nullptr;
+    /// Efficiency-aware roulette and splitting instead of the roulette of the policy (where it has a factor)
+    const EfficiencyRR *rr = nullptr;
+    /// Record of the vertices, to train \ref EfficiencyRR
+    PathRecord *record = nullptr;
+    /**
+     * Radiance cache. The path stops at the cached radiance of the first
+     * diffuse vertex at depth \c cacheDepth or deeper whose cell has enough
+     * samples; otherwise the radiance leaving its first diffuse vertices is
+     * added to the cache.
+     */
+    RadianceCache *cache = nullptr;
+    int cacheDepth = 3;
+    /// Additional radiance estimate and continuation sampling
+    const PathHook *hook = nullptr;
+    /// Report the radiance found along the sampled continuations to \ref PathHook::recordContinuation()
+    bool recordContinuations = false;
+};
+
+/**
+ * \brief Path tracing kernel shared by all the path based integrators
+ *
+ * The loop carries the intersection of the BSDF continuation ray forward:
+ * it is traced once, used to look up the emitter pdf for MIS and then
+ * becomes the next vertex of the path. Every branch that depends on the
+ * policy is a compile-time constant, so each instantiation only keeps the
+ * code of its own strategy.
+ */
+template <typename Policy> struct PathKernel {
+    /**
+     * \brief Estimate the incident radiance along \c ray
+     *
+     * \param reusedHits
+     *    Incremented once per continuation hit that was traced for the
+     *    MIS lookup and then reused as the next vertex
+     */
+    static Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, uint64_t &reusedHits,
+            const PathOptions &options = PathOptions()) {
+        Ray3f pathRay(ray);
+        Intersection its;
+        if (!scene->rayIntersect(pathRay, its))
+            return Color3f(0.f);
+
+        Context context { reusedHits, options.counters, options.rr, options.record, options.cache,
+            options.cacheDepth, options.hook, options.hook && options.recordContinuations, MAX_PATH_LENGTH, 0 };
+        return trace(scene, sampler, context, pathRay, its, Color3f(1.f), 1.f, 0, false, false);
+    }
+
+private:
+    struct Context {
+        uint64_t &reusedHits;
+        PathCounters *counters;
+        const EfficiencyRR *rr;
+        PathRecord *record;
+        RadianceCache *cache;
+        int cacheDepth;
+        const PathHook *hook;
+        bool recordContinuations;
+        /// Copies that splitting may still create for this camera ray
+        int splitBudget;
+        /// Copies of this camera ray ended by a radiance cache lookup so far
+        uint32_t cacheHits;
+    };
+
+    /// Vertices of a path whose outgoing radiance goes into the radiance cache
+    static constexpr int CacheVertices = 16;
+
+    struct CacheVertex {
+        Point3f p;
+        /// Normal on the side the path arrived from
+        Normal3f n;
+        /// Direction towards the previous vertex
+        Vector3f wo;
+        Color3f throughput;
+        /// Radiance the path had collected before the vertex
+        Color3f before;
+        /// \ref Context::cacheHits at the vertex
+        uint32_t cacheHits;
+    };
+
+    /// Continuation sampled by the hook, whose radiance is reported at the end of the path
+    struct ContinuationVertex {
+        Point3f p;
+        /// Direction (world space) and its density
+        Vector3f d;
+        float pdf;
+        /// Throughput including the vertex
+        Color3f throughput;
+        /// Radiance the path had collected before the continuation
+        Color3f before;
+    };
+
+    /**
+     * \brief Continue a path from the vertex \c its, reached by \c pathRay
+     *
+     * \param decided
+     *    The roulette or splitting of this vertex has already been done
+     *    (a copy made by splitting)
+     * \param diffuseSeen
+     *    The path went through a non-specular vertex before \c its
+     */
+    static Color3f trace(const Scene *scene, Sampler *sampler, Context &context, Ray3f pathRay, Intersection its,
+            Color3f throughput, float emissionWeight, int depth, bool decided, bool diffuseSeen) {
+        Color3f myLi(0.f);
+        CacheVertex cacheVertices[CacheVertices];
+        int cacheCount = 0;
+        ContinuationVertex continuations[MAX_PATH_LENGTH];
+        int continuationCount = 0;
+
+        for (; ; ++depth) {
+            if (!decided) {
+                if (context.counters)
+                    context.counters->vertices++;
+                if (context.record && !its.mesh->isEmitter())
+                    context.record->add(depth, throughput.getLuminance(), myLi.getLuminance());
+
+                if (context.cache && !its.mesh->isEmitter() && its.mesh->getBSDF()->isDiffuse()) {
+                    Normal3f n = its.shFrame.n.dot(pathRay.d) > 0.f ? Normal3f(-its.shFrame.n) : its.shFrame.n;
+                    Color3f cached;
+                    if (depth >= context.cacheDepth && context.cache->lookup(its.p, n, -pathRay.d, cached)) {
+                        /* End the path with the cached radiance instead of tracing the rest of it */
+                        myLi += throughput * cached;
+                        context.cacheHits++;
+                        if (context.counters)
+                            context.counters->cacheHits++;
+                        break;
+                    }
+                    if (cacheCount < CacheVertices)
+                        cacheVertices[cacheCount++] = CacheVertex { its.p, n, -pathRay.d, throughput, myLi, context.cacheHits };
+                }
+
+                /* Emitter hits end the path anyway: nothing to gain there */
+                float q = context.rr && !its.mesh->isEmitter() ? context.rr->factor(depth, throughput.getLuminance()) : 0.f;
+                if (q > 0.f) {
+                    // Ruleta rusa o division
+                    q = std::min(q, 1.f + (float) context.splitBudget);
+                    float u = sampler->next1D();
+                    int copies = (int) q + (u < q - std::floor(q) ? 1 : 0);
+                    if (copies == 0)
+                        break;
+                    throughput /= q;
+                    for (int i = 1; i < copies; ++i) {
+                        context.splitBudget--;
+                        if (context.counters)
+                            context.counters->splits++;
+                        myLi += trace(scene, sampler, context, pathRay, its, throughput, emissionWeight, depth, true, diffuseSeen);
+                    }
+                } else if (Policy::RR == ERussianRoulette::ELuminance) {
+                    // Ruleta rusa
+                    float probRR = std::min(throughput.getLuminance(), 1.0f);
+                    if (sampler->next1D() >= probRR)
+                        break;
+                    throughput /= probRR;
+                }
+            }
+            decided = false;
+
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eQR(pathRay.o, its.p, its.shFrame.n);
+                myLi += its.mesh->getEmitter()->eval(eQR) * throughput * emissionWeight;
+                break;
+            }
+
+            if (depth >= Policy::MaxDepth)
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-pathRay.d);
+
+            if (context.hook && bsdf->isDiffuse())
+                myLi += throughput * context.hook->vertexRadiance(its, bsdf, wi);
+
+            //EMS
+            if (Policy::NEE) {
+                EmitterQueryRecord lRec(its.p, its.shFrame.n);
+                Color3f lRef = scene->sampleEmitter(lRec, sampler->next2D());
+
+                BSDFQueryRecord bsdfQR_EMS(wi, its.toLocal(lRec.wi), ESolidAngle);
+                Color3f bsdfColor = bsdf->eval(bsdfQR_EMS);
+                float cosTheta = Frame::cosTheta(its.shFrame.toLocal(lRec.wi));
+
+                float w_ems = 1.f;
+                if (Policy::MIS != EMISHeuristic::ENone)
+                    w_ems = misWeight<Policy::MIS>(lRec.pdf, context.hook ?
+                        context.hook->pdfContinuation(its, bsdf, bsdfQR_EMS) : bsdf->pdf(bsdfQR_EMS));
+
+                myLi += lRef * bsdfColor * cosTheta * throughput * w_ems;
+
+                /* Without MIS the emitter hit by the last bounce would not
+                   contribute anyway, so do not trace it */
+                if (Policy::MIS == EMISHeuristic::ENone && depth + 1 >= Policy::MaxDepth)
+                    break;
+            }
+
+            //BSDF
+            BSDFQueryRecord bsdfQR(wi);
+            float hookPdf = 0.f;
+            Color3f fr = context.hook ? context.hook->sampleContinuation(its, bsdf, bsdfQR, sampler, hookPdf)
+                : bsdf->sample(bsdfQR, sampler->next2D());
+            throughput *= fr;
+
+            Vector3f d = its.toWorld(bsdfQR.wo);
+            if (context.recordContinuations && bsdf->isDiffuse() && bsdfQR.measure != EDiscrete
+                    && !fr.isZero() && continuationCount < MAX_PATH_LENGTH)
+                continuations[continuationCount++] = ContinuationVertex { its.p, d, hookPdf, throughput, myLi };
+
+            Point3f origin = its.p;
+            Normal3f originN = its.shFrame.n;
+            pathRay = Ray3f(its.p, d);
+            if (!scene->rayIntersect(pathRay, its))
+                break;
+
+            if (!Policy::NEE || bsdfQR.measure == EDiscrete) {
+                /* Emitter sampling cannot produce this direction */
+                emissionWeight = 1.f;
+            } else if (Policy::MIS == EMISHeuristic::ENone) {
+                emissionWeight = 0.f;
+            } else {
+                float pdf_mat = context.hook ? hookPdf : bsdf->pdf(bsdfQR);
+                float pdf_em = scene->pdfEmitter(origin, originN, its);
+                emissionWeight = misWeight<Policy::MIS>(pdf_mat, pdf_em);
+                context.reusedHits++;
+            }
+
+            /* Emitters reached from a non-specular vertex through specular
+               bounces only are left to the hook */
+            if (context.hook && context.hook->coversCaustics()) {
+                diffuseSeen |= bsdf->isDiffuse();
+                if (diffuseSeen && !bsdf->isDiffuse())
+                    emissionWeight = 0.f;
+            }
+        }
+
+        /* Radiance that left each recorded vertex towards the previous one.
+           Vertices whose rest of the path (or a split copy of it) ended at a
+           cache lookup are left out: the cache would feed on its own values */
+        for (int i = 0; i < cacheCount; ++i) {
+            const CacheVertex &v = cacheVertices[i];
+            if (v.cacheHits != context.cacheHits)
+                continue;
+            Color3f Lr(0.f);
+            for (int c = 0; c < 3; ++c)
+                Lr[c] = v.throughput[c] > 0.f ? (myLi[c] - v.before[c]) / v.throughput[c] : 0.f;
+            context.cache->add(v.p, v.n, v.wo, Lr);
+        }
+
+        /* Radiance found along each sampled continuation */
+        for (int i = 0; i < continuationCount; ++i) {
+            const ContinuationVertex &v = continuations[i];
+            Color3f radiance(0.f);
+            for (int c = 0; c < 3; ++c)
+                radiance[c] = v.throughput[c] > 0.f ? (myLi[c] - v.before[c]) / v.throughput[c] : 0.f;
+            context.hook->recordContinuation(v.p, v.d, v.pdf, radiance);
+        }
+
+        return myLi;
+    }
+};
+
+template <typename Policy> struct WavefrontKernel;
+
+/**
+ * \brief Integrator front-end for a \ref PathKernel instantiation
+ *
+ * The registered integrators ("pathtracer", "pathtracer_nee", ...) derive
+ * from this class with their own policy and only provide a name. They share
+ * the properties of the roulette: \c rr is \c "luminance" (default, the
+ * policy's roulette) or \c "efficiency" (\ref EfficiencyRR, trained by
+ * \ref preprocess() with \c rrTraining samples on every fourth pixel of
+ * every fourth row, splitting into at most \c rrMaxSplit copies).
+ *
+ * With \c radianceCache set, \ref preprocess() creates a \ref RadianceCache
+ * (\c cacheEntries cells of \c cacheCellSize, default: the scene diagonal
+ * / 256) that the render fills as it goes; paths end at their first diffuse
+ * vertex at depth \c cacheDepth (default 3) or deeper whose cell has
+ * \c cacheMinSamples samples. Only paths traced to their end fill the cache,
+ * so cached radiance is never fed back into it. This is biased, and the
+ * result depends on the order in which the threads render.
+ */
+template <typename Policy> class PathIntegrator : public Integrator {
+public:
+    PathIntegrator(const std::string &name, const PropertyList &props) : m_name(name) {
+        std::string rr = props.getString("rr", "luminance");
+        if (rr == "efficiency")
+            m_efficiencyRR = true;
+        else if (rr != "luminance")
+            throw NoriException("%s: unknown russian roulette \"%s\"", name, rr);
+        m_rrTraining = std::max(props.getInteger("rrTraining", 4), 2);
+        m_rr = EfficiencyRR(std::max(props.getFloat("rrMaxSplit", 8.f), 1.f));
+
+        m_radianceCache = props.getBoolean("radianceCache", false);
+        m_cacheDepth = std::max(props.getInteger("cacheDepth", 3), 1);
+        m_cacheCellSize = props.getFloat("cacheCellSize", 0.f);
+        m_cacheEntries = std::max(props.getInteger("cacheEntries", 1 << 20), 1);
+        m_cacheMinSamples = std::max(props.getInteger("cacheMinSamples", 16), 1);
+    }
+
+    virtual ~PathIntegrator() {
+        if (Policy::MIS != EMISHeuristic::ENone)
+            cout << m_name << ": " << m_reusedHits << " closest-hit traversals saved by reusing continuation hits" << endl;
+        if (m_samples > 0)
+            cout << tfm::format("%s: average path length %.2f vertices, %i splits", m_name,
+                (double) m_vertices / (double) m_samples, (uint64_t) m_splits) << endl;
+        if (m_cache)
+            cout << tfm::format("%s: %i paths ended by the radiance cache (%.1f%%), %i cells in use (%s)", m_name,
+                (uint64_t) m_cacheHits, 100.0 * (double) m_cacheHits / (double) std::max((uint64_t) m_samples, (uint64_t) 1),
+                m_cache->getCellCount(), memString(m_cache->getMemoryUsage())) << endl;
+    }
+
+    /// Create the radiance cache and train the efficiency-aware roulette, if enabled
+    void preprocess(const Scene *scene) {
+        if (m_radianceCache) {
+            float cellSize = m_cacheCellSize > 0.f ? m_cacheCellSize :
+                scene->getBoundingBox().getExtents().norm() / 256.f;
+            m_cache.reset(new RadianceCache(cellSize, (uint32_t) m_cacheEntries, (uint32_t) m_cacheMinSamples));
+        }
+        if (!m_efficiencyRR)
+            return;
+
+        /* Pixel variances and vertex statistics of a few paths on a coarse
+           grid of pixels, gathered per row and merged in order */
+        Timer timer;
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+        const int stride = 4;
+        int rows = (size.y() + stride - 1) / stride;
+        std::vector<EfficiencyRR::Statistics> rowStats(rows);
+        tbb::parallel_for(tbb::blocked_range<int>(0, rows), [&](const tbb::blocked_range<int> &range) {
+            for (int row = range.begin(); row < range.end(); ++row) {
+                std::unique_ptr<Sampler> sampler = createIndependentSampler((uint64_t) row);
+                EfficiencyRR::Statistics &stats = rowStats[row];
+                int y = row * stride + stride / 2;
+                for (int x = stride / 2; x < size.x(); x += stride) {
+                    double sum = 0, sum2 = 0;
+                    for (int i = 0; i < m_rrTraining; ++i) {
+                        Ray3f ray;
+                        Point2f pixelSample = Point2f((float) x, (float) std::min(y, size.y() - 1)) + sampler->next2D();
+                        Color3f weight = camera->sampleRay(ray, pixelSample, sampler->next2D());
+                        uint64_t reusedHits = 0;
+                        PathCounters counters;
+                        PathRecord record;
+                        PathOptions options;
+                        options.counters = &counters;
+                        options.record = &record;
+                        float value = PathKernel<Policy>::Li(scene, sampler.get(), ray, reusedHits, options).getLuminance();
+                        if (!std::isfinite(value))
+                            continue;
+                        stats.addPath(record, value, counters.vertices);
+                        value *= weight.getLuminance();
+                        sum += value;
+                        sum2 += value * value;
+                    }
+                    double mean = sum / m_rrTraining;
+                    stats.variance += std::max(sum2 - m_rrTraining * mean * mean, 0.0) / (m_rrTraining - 1);
+                    stats.pixels++;
+                }
+            }
+        });
+
+        EfficiencyRR::Statistics stats;
+        for (const EfficiencyRR::Statistics &row : rowStats)
+            stats.merge(row);
+        m_rr.build(stats);
+        cout << tfm::format("%s: efficiency-aware roulette trained on %i paths (%i depths, %s)", m_name,
+            stats.paths, m_rr.getDepthCount(), timer.elapsedString()) << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        uint64_t reusedHits = 0;
+        PathCounters counters;
+        PathOptions options;
+        options.counters = &counters;
+        options.rr = m_efficiencyRR ? &m_rr : nullptr;
+        options.cache = m_cache.get();
+        options.cacheDepth = m_cacheDepth;
+        Color3f result = PathKernel<Policy>::Li(scene, sampler, ray, reusedHits, options);
+        if (reusedHits)
+            m_reusedHits.fetch_add(reusedHits, std::memory_order_relaxed);
+        addCounters(counters, 1);
+        return result;
+    }
+
+    /// Splitting and the radiance cache need the recursive kernel, so they render one path at a time
+    bool supportsBatch() const { return !m_efficiencyRR && !m_cache; }
+
+    void LiBatch(const Scene *scene, Sampler *sampler, RayBatch &batch) const {
+        if (!supportsBatch()) {
+            Integrator::LiBatch(scene, sampler, batch);
+            return;
+        }
+        uint64_t reusedHits = 0;
+        PathCounters counters;
+        WavefrontKernel<Policy>::LiBatch(scene, sampler, batch, reusedHits, &counters);
+        if (reusedHits)
+            m_reusedHits.fetch_add(reusedHits, std::memory_order_relaxed);
+        addCounters(counters, batch.size());
+    }
+
+    std::string toString() const {
+        return tfm::format("%s[rr = %s, radianceCache = %s]", m_name,
+            m_efficiencyRR ? "efficiency" : "luminance", m_radianceCache ? "true" : "false");
+    }
+
+protected:
+    void addCounters(const PathCounters &counters, size_t samples) const {
+        m_vertices.fetch_add(counters.vertices, std::memory_order_relaxed);
+        m_samples.fetch_add(samples, std::memory_order_relaxed);
+        if (counters.splits)
+            m_splits.fetch_add(counters.splits, std::memory_order_relaxed);
+        if (counters.cacheHits)
+            m_cacheHits.fetch_add(counters.cacheHits, std::memory_order_relaxed);
+    }
+
+    std::string m_name;
+    /// Closest-hit traversals avoided by carrying the continuation hit forward
+    mutable std::atomic<uint64_t> m_reusedHits{ 0 };
+    /// Camera samples, path vertices and copies made by splitting
+    mutable std::atomic<uint64_t> m_samples{ 0 }, m_vertices{ 0 }, m_splits{ 0 };
+    /// Paths ended by the radiance cache
+    mutable std::atomic<uint64_t> m_cacheHits{ 0 };
+
+    bool m_efficiencyRR = false;
+    int m_rrTraining;
+    EfficiencyRR m_rr;
+
+    bool m_radianceCache = false;
+    int m_cacheDepth, m_cacheEntries, m_cacheMinSamples;
+    float m_cacheCellSize;
+    std::unique_ptr<RadianceCache> m_cache;
+};
+
+NORI_NAMESPACE_END
+
+/* Batched counterpart of PathKernel used by PathIntegrator::LiBatch() */
+#include <nori/wavefront.h>
@@ -26,8 +26,13 @@ NORI_NAMESPACE_BEGIN
 /**
  * \brief Perspective camera with depth of field
  *
- * This class implements a simple perspective camera model. It uses an
- * infinitesimally small aperture, creating an infinite depth of field.
+ * This class implements a simple perspective camera model. By default it
+ * uses an infinitesimally small aperture, creating an infinite depth of
+ * field. With a positive \c apertureSize it becomes a thin lens of that
+ * radius focused at \c focalDistance: the ray starts at the point of the
+ * lens given by the aperture sample and passes through the point of the
+ * focal plane that the pinhole ray would reach, so the blur is integrated
+ * by the ordinary pixel samples.
  */
 class PerspectiveCamera : public Camera {
 public:
@@ -45,8 +50,8 @@ public:
         /* Horizontal field of view in degrees */
         m_fov = propList.getFloat("fov", 30.0f);
 
-        m_apertureSize = propList.getFloat("apertureSize", 50.0f);
-        m_dofSamples = propList.getInteger("dofSamples", 50);
+        /* Lens radius and distance of the plane in focus. Default: pinhole */
+        m_apertureSize = propList.getFloat("apertureSize", 0.0f);
         m_focalDistance = propList.getFloat("focalDistance", 5.0f);
 
         /* Near and far clipping planes in world-space units */
@@ -103,9 +108,19 @@ public:
         /* Turn into a normalized ray direction, and
            adjust the ray interval accordingly */
         Vector3f d = nearP.normalized();
+        Point3f o(0.0f, 0.0f, 0.0f);
+
+        if (m_apertureSize > 0.0f) {
+            /* Thin lens: from a point on the lens towards the point
+               of the focal plane seen through the center */
+            Point2f pLens = Warp::squareToUniformDisk(apertureSample) * m_apertureSize;
+            Point3f pFocus = d * (m_focalDistance / d.z());
+            o = Point3f(pLens.x(), pLens.y(), 0.0f);
+            d = (pFocus - o).normalized();
+        }
         float invZ = 1.0f / d.z();
 
-        ray.o = m_cameraToWorld * Point3f(0, 0, 0);
+        ray.o = m_cameraToWorld * o;
         ray.d = m_cameraToWorld * d;
         ray.mint = m_nearClip * invZ;
         ray.maxt = m_farClip * invZ;
@@ -136,6 +151,8 @@ public:
             "  outputSize = %s,\n"
             "  fov = %f,\n"
             "  clip = [%f, %f],\n"
+            "  apertureSize = %f,\n"
+            "  focalDistance = %f,\n"
             "  rfilter = %s\n"
             "]",
             indent(m_cameraToWorld.toString(), 18),
@@ -143,6 +160,8 @@ public:
             m_fov,
             m_nearClip,
             m_farClip,
+            m_apertureSize,
+            m_focalDistance,
             indent(m_rfilter->toString())
         );
     }
@@ -0,0 +1,189 @@
+/*
+	Path tracing with a caustic photon map
+*/
+
+#include <nori/pathtracer.h>
+#include <nori/photonmap.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Paths of "pathtracer_nee"; the photon map is added through a \ref PathHook
+typedef PathPolicy<true, EMISHeuristic::EBalance, ERussianRoulette::ELuminance, MAX_PATH_LENGTH> PhotonCausticsPolicy;
+
+/**
+ * \brief Path tracer with caustics from a photon map
+ *
+ * Light that reaches a non-specular surface only through specular
+ * (e.g. dielectric) bounces cannot be found by next event estimation, and
+ * BSDF sampling only finds it when the path happens to hit the emitter, so
+ * caustics under glass converge very slowly. Before the render this
+ * integrator traces photons from the emitters (chosen by power) and stores
+ * those that arrive at a non-specular surface after one or more specular
+ * bounces: a caustic photon map (Jensen), in a \ref PhotonMap. \c photons
+ * is the number of photons stored, and so bounds the memory; emission stops
+ * once it is reached, or after \c maxPaths photon paths.
+ *
+ * The camera paths are those of "pathtracer_nee" (the shared \ref PathKernel),
+ * except that at every non-specular vertex the caustic radiance is estimated
+ * from the photons within \c radius (default: 1/200 of the scene diagonal),
+ * and emitters reached from a non-specular vertex through specular bounces
+ * no longer count, since that light is what the photons carry. The estimate
+ * is biased by the radius, but only for the caustic part of the image.
+ */
+class PhotonCaustics : public Integrator, public PathHook {
+public:
+    PhotonCaustics(const PropertyList &props) {
+        m_photonCount = (size_t) std::max(props.getInteger("photons", 200000), 0);
+        m_maxPaths = (size_t) std::max(props.getInteger("maxPaths", 0), 0);
+        if (m_maxPaths == 0)
+            m_maxPaths = m_photonCount * 100;
+        m_radius = props.getFloat("radius", 0.f);
+    }
+
+    void preprocess(const Scene *scene) {
+        Timer timer;
+        float radius = m_radius;
+        if (!(radius > 0.f))
+            radius = scene->getBoundingBox().getExtents().norm() / 200.f;
+
+        std::vector<Photon> photons;
+        size_t paths = 0;
+        if (m_photonCount > 0 && !scene->getEmitters().empty()) {
+            photons.reserve(m_photonCount);
+
+            /* Rounds of a fixed number of chunks, each with its own random
+               sequence: the photons are the same whatever the thread count */
+            const size_t chunkCount = 64, chunkPaths = 4096;
+            std::vector<std::vector<Photon>> chunkPhotons(chunkCount);
+            std::vector<std::vector<uint32_t>> chunkIndices(chunkCount);
+            for (size_t round = 0; photons.size() < m_photonCount && paths < m_maxPaths; ++round) {
+                tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkCount), [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t c = range.begin(); c < range.end(); ++c) {
+                        pcg32 random;
+                        random.seed(round * chunkCount + c, 0x2545f491ull);
+                        chunkPhotons[c].clear();
+                        chunkIndices[c].clear();
+                        for (uint32_t i = 0; i < (uint32_t) chunkPaths; ++i) {
+                            Photon photon;
+                            if (tracePhoton(scene, random, photon)) {
+                                chunkPhotons[c].push_back(photon);
+                                chunkIndices[c].push_back(i);
+                            }
+                        }
+                    }
+                });
+
+                /* Take the photons in order; when the map is full, the paths
+                   emitted are counted up to the one of the last photon */
+                for (size_t c = 0; c < chunkCount && paths < m_maxPaths; ++c) {
+                    size_t i = 0;
+                    for (; i < chunkPhotons[c].size() && photons.size() < m_photonCount; ++i)
+                        photons.push_back(chunkPhotons[c][i]);
+                    if (i < chunkPhotons[c].size() || photons.size() == m_photonCount) {
+                        paths += i > 0 ? chunkIndices[c][i - 1] + 1 : 0;
+                        break;
+                    }
+                    paths += chunkPaths;
+                }
+            }
+        }
+
+        /* Flux per emitted path */
+        float scale = paths > 0 ? 1.f / (float) paths : 0.f;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, photons.size()), [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i < range.end(); ++i)
+                photons[i].power *= scale;
+        });
+        m_map.build(std::move(photons), radius);
+
+        cout << tfm::format("Caustic photon map: %i photons from %i paths, radius %f, %s, built in %s",
+            m_map.size(), paths, radius, memString(m_map.getMemoryUsage()), timer.elapsedString()) << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        uint64_t reusedHits = 0;
+        PathOptions options;
+        options.hook = this;
+        return PathKernel<PhotonCausticsPolicy>::Li(scene, sampler, ray, reusedHits, options);
+    }
+
+    /// Caustic radiance from the photons around \c its
+    Color3f vertexRadiance(const Intersection &its, const BSDF *bsdf, const Vector3f &wi) const {
+        Color3f caustic(0.f);
+        m_map.query(its.p, [&](const Photon &photon, float) {
+            BSDFQueryRecord bRec(wi, its.toLocal(photon.wi), ESolidAngle);
+            caustic += bsdf->eval(bRec) * photon.power;
+        });
+        return caustic * (INV_PI / (m_map.getRadius() * m_map.getRadius()));
+    }
+
+    bool coversCaustics() const { return true; }
+
+    std::string toString() const {
+        return tfm::format(
+            "PhotonCaustics[\n"
+            "  photons = %i,\n"
+            "  maxPaths = %i,\n"
+            "  radius = %f\n"
+            "]",
+            m_photonCount, m_maxPaths, m_radius
+        );
+    }
+
+private:
+    /**
+     * \brief Trace one photon path, \c true if it left a caustic photon
+     *
+     * The photon is stored at the first non-specular surface, provided it
+     * got there through at least one specular bounce.
+     */
+    bool tracePhoton(const Scene *scene, pcg32 &random, Photon &photon) const {
+        float pmf;
+        const Emitter *emitter = scene->sampleEmitterPower(random.nextFloat(), pmf);
+        if (!emitter)
+            return false;
+        Ray3f ray;
+        Normal3f n;
+        Point2f positionSample(random.nextFloat(), random.nextFloat());
+        Color3f power = emitter->samplePhoton(ray, n, positionSample, Point2f(random.nextFloat(), random.nextFloat())) / pmf;
+        if (power.isZero())
+            return false;
+
+        for (int depth = 0; depth < MAX_PATH_LENGTH; ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its) || its.mesh->isEmitter())
+                return false;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (bsdf->isDiffuse()) {
+                if (depth == 0)
+                    return false;
+                photon.p = its.p;
+                photon.wi = -ray.d;
+                photon.power = power;
+                return true;
+            }
+
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            Color3f weight = bsdf->sample(bRec, Point2f(random.nextFloat(), random.nextFloat()));
+            float probRR = std::min(weight.getLuminance(), 1.0f);
+            if (!(probRR > 0.f) || random.nextFloat() >= probRR)
+                return false;
+            power *= weight / probRR;
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return false;
+    }
+
+    size_t m_photonCount;
+    size_t m_maxPaths;
+    float m_radius;
+    PhotonMap m_map;
+};
+
+NORI_REGISTER_CLASS(PhotonCaustics, "photon_caustics");
+NORI_NAMESPACE_END
@@ -0,0 +1,70 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/photonmap.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
+#include <numeric>
+
+NORI_NAMESPACE_BEGIN
+
+void PhotonMap::build(std::vector<Photon> &&photons, float radius) {
+    m_radius = radius;
+    m_cellSize = 2.f * radius;
+
+    uint32_t buckets = 1;
+    while (buckets < 2 * photons.size() && buckets < (1u << 31))
+        buckets <<= 1;
+    m_bucketMask = buckets - 1;
+
+    /* Bucket of every photon, then the photons sorted by bucket (and by
+       their original order within a bucket, so the result is deterministic) */
+    uint32_t n = (uint32_t) photons.size();
+    std::vector<uint32_t> keys(n), order(n);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, n), [&](const tbb::blocked_range<uint32_t> &range) {
+        for (uint32_t i = range.begin(); i < range.end(); ++i)
+            keys[i] = getBucket(photons[i].p);
+    });
+    std::iota(order.begin(), order.end(), 0u);
+    tbb::parallel_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+    });
+
+    m_photons.resize(n);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, n), [&](const tbb::blocked_range<uint32_t> &range) {
+        for (uint32_t i = range.begin(); i < range.end(); ++i)
+            m_photons[i] = photons[order[i]];
+    });
+
+    /* Photon i starts the buckets between the one of photon i - 1 (excluded) and its own */
+    m_bucketStart.resize((size_t) buckets + 1);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, n + 1), [&](const tbb::blocked_range<uint32_t> &range) {
+        for (uint32_t i = range.begin(); i < range.end(); ++i) {
+            uint64_t first = i == 0 ? 0 : (uint64_t) keys[order[i - 1]] + 1;
+            uint64_t last = i == n ? (uint64_t) buckets : (uint64_t) keys[order[i]];
+            for (uint64_t bucket = first; bucket <= last; ++bucket)
+                m_bucketStart[bucket] = i;
+        }
+    });
+
+    photons.clear();
+    photons.shrink_to_fit();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,112 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/vector.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/// A photon stored on a surface
+struct Photon {
+    /// Position
+    Point3f p;
+    /// Direction the photon came from (pointing away from the surface)
+    Vector3f wi;
+    /// Flux
+    Color3f power;
+};
+
+/**
+ * \brief Hashed uniform grid of photons for fixed-radius lookups
+ *
+ * The grid cells are twice the lookup radius wide, so the photons within
+ * the radius of any point lie in the 2x2x2 cells around it. Cells are
+ * hashed into a table with about two buckets per photon, and the photons
+ * are stored sorted by bucket: a lookup scans at most eight contiguous
+ * ranges of the photon array. The build (keys, sort and bucket ranges) runs
+ * in parallel and is deterministic. Memory: the photons plus one 32-bit
+ * offset per bucket.
+ */
+class PhotonMap {
+public:
+    /// Sort \c photons into the grid for lookups with the given radius
+    void build(std::vector<Photon> &&photons, float radius);
+
+    /// Call \c f(photon, squaredDistance) for every photon within the radius of \c p
+    template <typename Functor> void query(const Point3f &p, const Functor &f) const {
+        if (m_photons.empty())
+            return;
+        float r2 = m_radius * m_radius;
+        Vector3f c = p / m_cellSize - Vector3f::Constant(0.5f);
+        int x0 = (int) std::floor(c.x()), y0 = (int) std::floor(c.y()), z0 = (int) std::floor(c.z());
+
+        /* Neighbouring cells may share a bucket: visit each bucket once */
+        uint32_t buckets[8];
+        int count = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint32_t bucket = getBucket(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + (i >> 2));
+            bool seen = false;
+            for (int j = 0; j < count; ++j)
+                seen |= buckets[j] == bucket;
+            if (!seen)
+                buckets[count++] = bucket;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            for (uint32_t k = m_bucketStart[buckets[i]]; k < m_bucketStart[buckets[i] + 1]; ++k) {
+                const Photon &photon = m_photons[k];
+                float d2 = (photon.p - p).squaredNorm();
+                if (d2 <= r2)
+                    f(photon, d2);
+            }
+        }
+    }
+
+    /// Number of photons
+    size_t size() const { return m_photons.size(); }
+
+    /// Lookup radius
+    float getRadius() const { return m_radius; }
+
+    /// Memory used by the photons and the bucket table, in bytes
+    size_t getMemoryUsage() const {
+        return m_photons.size() * sizeof(Photon) + m_bucketStart.size() * sizeof(uint32_t);
+    }
+
+private:
+    uint32_t getBucket(int x, int y, int z) const {
+        uint32_t h = (uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u ^ (uint32_t) z * 83492791u;
+        return h & m_bucketMask;
+    }
+
+    uint32_t getBucket(const Point3f &p) const {
+        return getBucket((int) std::floor(p.x() / m_cellSize), (int) std::floor(p.y() / m_cellSize),
+            (int) std::floor(p.z() / m_cellSize));
+    }
+
+    std::vector<Photon> m_photons;
+    /// First photon of every bucket, plus the photon count at the end
+    std::vector<uint32_t> m_bucketStart;
+    uint32_t m_bucketMask = 0;
+    float m_radius = 0.f, m_cellSize = 1.f;
+};
+
+NORI_NAMESPACE_END
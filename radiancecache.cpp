@@ -0,0 +1,118 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/radiancecache.h>
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Slots tried after the home slot of a key
+    const uint32_t probeCount = 8;
+    /// Fixed-point scale of the radiance sums, and largest radiance added
+    const float fixedScale = 65536.f;
+    const float maxRadiance = 65535.f;
+
+    inline uint64_t mix(uint64_t x) {
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+}
+
+RadianceCache::Entry::Entry() : key(0), count(0) {
+    for (int i = 0; i < 3; ++i)
+        sum[i].store(0, std::memory_order_relaxed);
+}
+
+RadianceCache::RadianceCache(float cellSize, uint32_t entries, uint32_t minSamples)
+    : m_minSamples(std::max(minSamples, 1u)), m_invCellSize(1.f / cellSize) {
+    uint32_t size = 1;
+    while (size < entries && size < (1u << 31))
+        size <<= 1;
+    m_entries.reset(new Entry[size]);
+    m_mask = size - 1;
+}
+
+uint64_t RadianceCache::getKey(const Point3f &p, const Normal3f &n, const Vector3f &wo) const {
+    uint64_t key = 1ull << 63;
+    for (int i = 0; i < 3; ++i) {
+        uint64_t cell = (uint64_t) (int64_t) std::floor(p[i] * m_invCellSize) & 0x1ffffull;
+        uint64_t orientation = (uint64_t) std::min(std::max((int) ((n[i] + 1.f) * 2.f), 0), 3);
+        uint64_t direction = (uint64_t) std::min(std::max((int) ((wo[i] + 1.f) * 2.f), 0), 3);
+        key |= cell << (12 + 17 * i);
+        key |= direction << (6 + 2 * i);
+        key |= orientation << (2 * i);
+    }
+    return key;
+}
+
+void RadianceCache::add(const Point3f &p, const Normal3f &n, const Vector3f &wo, const Color3f &radiance) {
+    if (!radiance.isValid())
+        return;
+    uint64_t key = getKey(p, n, wo);
+    uint32_t slot = (uint32_t) mix(key) & m_mask;
+    for (uint32_t i = 0; i < probeCount; ++i, slot = (slot + 1) & m_mask) {
+        Entry &entry = m_entries[slot];
+        uint64_t current = entry.key.load(std::memory_order_acquire);
+        /* Claim an empty slot; if another thread wins, current receives its key */
+        if (current == 0 && entry.key.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+            current = key;
+        if (current != key)
+            continue;
+
+        for (int c = 0; c < 3; ++c) {
+            float value = std::min(std::max(radiance[c], 0.f), maxRadiance);
+            entry.sum[c].fetch_add((uint64_t) (value * fixedScale), std::memory_order_relaxed);
+        }
+        entry.count.fetch_add(1, std::memory_order_release);
+        return;
+    }
+}
+
+bool RadianceCache::lookup(const Point3f &p, const Normal3f &n, const Vector3f &wo, Color3f &radiance) const {
+    uint64_t key = getKey(p, n, wo);
+    uint32_t slot = (uint32_t) mix(key) & m_mask;
+    for (uint32_t i = 0; i < probeCount; ++i, slot = (slot + 1) & m_mask) {
+        const Entry &entry = m_entries[slot];
+        uint64_t current = entry.key.load(std::memory_order_acquire);
+        if (current == 0)
+            return false;
+        if (current != key)
+            continue;
+
+        uint32_t count = entry.count.load(std::memory_order_acquire);
+        if (count < m_minSamples)
+            return false;
+        float scale = 1.f / (fixedScale * (float) count);
+        radiance = Color3f(entry.sum[0].load(std::memory_order_relaxed) * scale,
+                           entry.sum[1].load(std::memory_order_relaxed) * scale,
+                           entry.sum[2].load(std::memory_order_relaxed) * scale);
+        return true;
+    }
+    return false;
+}
+
+size_t RadianceCache::getCellCount() const {
+    size_t cells = 0;
+    for (uint32_t i = 0; i <= m_mask; ++i)
+        cells += m_entries[i].key.load(std::memory_order_relaxed) != 0;
+    return cells;
+}
+
+NORI_NAMESPACE_END
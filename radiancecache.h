@@ -0,0 +1,84 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/vector.h>
+#include <atomic>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief World-space hashed radiance cache
+ *
+ * Averages the radiance leaving the surfaces over cells of a uniform grid,
+ * split by the orientation of the normal and by the direction the radiance
+ * leaves in (each component quantized to four ranges), so that glossy
+ * surfaces keep a coarse view dependence. A cell is identified by a 63-bit
+ * key (17 bits per coordinate, 6 for the normal, 6 for the direction)
+ * stored in an open-addressing table with linear probing.
+ * Entries are claimed by compare-and-swap on the key and accumulate
+ * fixed-point radiance sums and a sample count with atomic additions, so
+ * any number of threads can update and read the cache without locks. When
+ * the probe window of a cell is full, its samples are dropped.
+ */
+class RadianceCache {
+public:
+    /**
+     * \param cellSize
+     *    Edge length of the grid cells (world units)
+     * \param entries
+     *    Table size, rounded up to a power of two
+     * \param minSamples
+     *    Samples a cell needs before \ref lookup() uses it
+     */
+    RadianceCache(float cellSize, uint32_t entries, uint32_t minSamples);
+
+    /// Add a sample of the radiance leaving \c p (normal \c n) in the direction \c wo
+    void add(const Point3f &p, const Normal3f &n, const Vector3f &wo, const Color3f &radiance);
+
+    /// Mean radiance of the cell of \c p, \c n and \c wo, \c false if it has too few samples
+    bool lookup(const Point3f &p, const Normal3f &n, const Vector3f &wo, Color3f &radiance) const;
+
+    /// Number of cells in use (scans the table)
+    size_t getCellCount() const;
+
+    /// Memory used by the table, in bytes
+    size_t getMemoryUsage() const { return (size_t) (m_mask + 1) * sizeof(Entry); }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> key;
+        /// Radiance sums in fixed point
+        std::atomic<uint64_t> sum[3];
+        std::atomic<uint32_t> count;
+
+        Entry();
+    };
+
+    uint64_t getKey(const Point3f &p, const Normal3f &n, const Vector3f &wo) const;
+
+    std::unique_ptr<Entry[]> m_entries;
+    uint32_t m_mask;
+    uint32_t m_minSamples;
+    float m_invCellSize;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,114 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/ray.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Structure-of-arrays queue of rays
+ *
+ * Each component lives in its own contiguous array so that the stages of
+ * a batched integrator can stream through them (and vectorize over them).
+ */
+struct RayQueue {
+    std::vector<float> ox, oy, oz;
+    std::vector<float> dx, dy, dz;
+    std::vector<float> mint, maxt;
+
+    /// Return the number of rays in the queue
+    size_t size() const { return ox.size(); }
+
+    /// Resize all component arrays
+    void resize(size_t size) {
+        for (std::vector<float> *c : { &ox, &oy, &oz, &dx, &dy, &dz, &mint, &maxt })
+            c->resize(size);
+    }
+
+    /// Remove all rays (keeps the allocated memory)
+    void clear() { resize(0); }
+
+    /// Store \c ray at position \c i
+    void set(size_t i, const Ray3f &ray) {
+        ox[i] = ray.o.x(); oy[i] = ray.o.y(); oz[i] = ray.o.z();
+        dx[i] = ray.d.x(); dy[i] = ray.d.y(); dz[i] = ray.d.z();
+        mint[i] = ray.mint; maxt[i] = ray.maxt;
+    }
+
+    /// Append \c ray to the queue
+    void push(const Ray3f &ray) {
+        resize(size() + 1);
+        set(size() - 1, ray);
+    }
+
+    /// Reassemble the ray stored at position \c i
+    Ray3f get(size_t i) const {
+        return Ray3f(Point3f(ox[i], oy[i], oz[i]), Vector3f(dx[i], dy[i], dz[i]), mint[i], maxt[i]);
+    }
+};
+
+/// Structure-of-arrays queue of RGB values
+struct ColorQueue {
+    std::vector<float> r, g, b;
+
+    size_t size() const { return r.size(); }
+
+    void resize(size_t size) { r.resize(size); g.resize(size); b.resize(size); }
+
+    void clear() { resize(0); }
+
+    /// Set all entries to zero
+    void setZero() {
+        std::fill(r.begin(), r.end(), 0.f);
+        std::fill(g.begin(), g.end(), 0.f);
+        std::fill(b.begin(), b.end(), 0.f);
+    }
+
+    void set(size_t i, const Color3f &c) { r[i] = c.r(); g[i] = c.g(); b[i] = c.b(); }
+
+    void add(size_t i, const Color3f &c) { r[i] += c.r(); g[i] += c.g(); b[i] += c.b(); }
+
+    void push(const Color3f &c) { resize(size() + 1); set(size() - 1, c); }
+
+    Color3f get(size_t i) const { return Color3f(r[i], g[i], b[i]); }
+};
+
+/**
+ * \brief A tile's worth of camera rays together with the radiance
+ * estimates computed for them by \ref Integrator::LiBatch()
+ */
+struct RayBatch {
+    /// Camera rays, filled in by the renderer
+    RayQueue rays;
+    /// Incident radiance along each ray, filled in by the integrator
+    ColorQueue Li;
+    /// Sampler state of each ray's pixel sample, after the camera samples (see \ref SamplerState)
+    std::vector<SamplerState> samplerStates;
+    /// Pixels per row when the rays cover an image tile in scanline order (0: unknown layout)
+    uint32_t width = 0;
+
+    size_t size() const { return rays.size(); }
+
+    void resize(size_t size) { rays.resize(size); Li.resize(size); samplerStates.resize(size); }
+};
+
+NORI_NAMESPACE_END
@@ -22,12 +22,18 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
-#include <nori/dpdf.h>
+#include <nori/alias.h>
+#include <nori/timer.h>
+#include <nori/cache.h>
+#include <filesystem/resolver.h>
+#include <chrono>
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
-    m_accel = new Accel();
+Scene::Scene(const PropertyList &props) {
+    m_accel = new Accel(props);
+    m_cacheFile = props.getString("cache", "");
+    setEmitterSampling(props.getString("emitterSampling", "power"));
 }
 
 Scene::~Scene() {
@@ -35,9 +41,10 @@ Scene::~Scene() {
     delete m_sampler;
     delete m_camera;
     delete m_integrator;
+    delete m_lightBVH;
 }
 
-const Color3f Scene::sampleEmitter(EmitterQueryRecord &lRec, const Point2f &sample) const
+const Color3f Scene::sampleEmitterUnshadowed(EmitterQueryRecord &lRec, const Point2f &sample) const
 {
     // 1. Muestrear el emisor concreto y obtener su radiancia emitida
     Point2f s(sample);
@@ -48,6 +55,28 @@ const Color3f Scene::sampleEmitter(EmitterQueryRecord &lRec, const Point2f &samp
     // 1.2 Calcular la probabilidad del emitter
     //float pdf_emitter = 1.0f / (float)m_emitters.size();
 
+    if (m_lightBVH) {
+        /* Emitter triangle chosen by the light hierarchy for this shading point */
+        const Mesh *mesh;
+        uint32_t triangle;
+        float pmf;
+        if (!m_lightBVH->sample(lRec.ref, lRec.refN, s.x(), mesh, triangle, pmf)) {
+            lRec.pdf = 0.0f;
+            return Color3f(0.0f);
+        }
+
+        mesh->sampleTriangle(triangle, s, lRec);
+        lRec.wi = (lRec.p - lRec.ref).normalized();
+        float cosTheta = lRec.n.dot(-lRec.wi);
+        if (cosTheta <= 0.0f) {
+            lRec.pdf = 0.0f;
+            return Color3f(0.0f);
+        }
+        lRec.pdf *= pmf * (lRec.p - lRec.ref).squaredNorm() / cosTheta;
+        lRec.emitter = mesh->getEmitter();
+        return lRec.emitter->eval(lRec) / lRec.pdf;
+    }
+
     // Parte: Muestreo de emisores con probabilidad asociada a radiancia
     float pdf_emitter;
     int index = dpdf.sampleReuse(s.x(), pdf_emitter);
@@ -60,18 +89,211 @@ const Color3f Scene::sampleEmitter(EmitterQueryRecord &lRec, const Point2f &samp
 
     //  1.5 Dividir la radiancia ponderada por la probabilidad del emisor
     Color3f rad = e->sample(lRec, s);
-    rad = rad / pdf_emitter;
+    lRec.emitter = e;
+
+    // Densidad en angulo solido, incluyendo la probabilidad de elegir el emisor (para MIS)
+    float pdf = e->pdf(lRec);
+    lRec.pdf = pdf > 0.0f ? pdf_emitter * pdf : 0.0f;
+    return rad / pdf_emitter;
+}
+
+float Scene::pdfEmitter(const Point3f &ref, const Normal3f &refN, const Intersection &its) const {
+    if (!its.mesh || !its.mesh->isEmitter())
+        return 0.0f;
+
+    EmitterQueryRecord eQR(ref, its.p, its.shFrame.n);
+    eQR.refN = refN;
+    eQR.triangle = its.triangle;
+    float cosTheta = eQR.n.dot(-eQR.wi);
+    if (cosTheta <= 0.0f)
+        return 0.0f;
+
+    if (m_lightBVH) {
+        float pmf = m_lightBVH->pmf(ref, refN, its.mesh, its.triangle);
+        return pmf * (its.p - ref).squaredNorm() / (cosTheta * its.mesh->surfaceArea(its.triangle));
+    }
+
+    const Emitter *emitter = its.mesh->getEmitter();
+    auto it = m_emitterIndex.find(emitter);
+    if (it == m_emitterIndex.end())
+        return 0.0f;
+    return dpdf[it->second] * emitter->pdf(eQR);
+}
+
+const Color3f Scene::sampleEmitter(EmitterQueryRecord &lRec, const Point2f &sample) const
+{
+    Color3f rad = sampleEmitterUnshadowed(lRec, sample);
 
     // 2. comprobar la visibilidad de la muestra generada en el emisor.Si no es visible, la radiancia a considerar es nula
-    if (rayIntersect(Ray3f(lRec.ref, lRec.wi, Epsilon, (lRec.p - lRec.ref).norm() - Epsilon)))
+    if (rayOccluded(Ray3f(lRec.ref, lRec.wi, Epsilon, (lRec.p - lRec.ref).norm() - Epsilon)))
         return Color3f(0.0f);
     
     return rad;
 
 }
 
+void Scene::rayOccluded(const RayQueue &rays, std::vector<uint8_t> &occluded) const {
+    auto start = std::chrono::steady_clock::now();
+    m_accel->rayOccludedStream(rays, occluded);
+    auto end = std::chrono::steady_clock::now();
+
+    m_occlusionRays.fetch_add(rays.size(), std::memory_order_relaxed);
+    m_occlusionTime.fetch_add((uint64_t) std::chrono::duration_cast<
+        std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+}
+
+uint64_t Scene::getCacheKey() const {
+    CacheHash hash;
+    hash.add((uint32_t) NORI_CACHE_VERSION);
+    m_accel->hashBuildParameters(hash);
+
+    hash.add((uint64_t) m_meshes.size());
+    for (const Mesh *mesh : m_meshes) {
+        const MatrixXf &V = mesh->getVertexPositions();
+        const MatrixXu &F = mesh->getIndices();
+        hash.add((uint64_t) V.size()).add(V.data(), V.size() * sizeof(float));
+        hash.add((uint64_t) F.size()).add(F.data(), F.size() * sizeof(uint32_t));
+        hash.add((uint8_t) mesh->isEmitter());
+    }
+    return hash.get();
+}
+
+bool Scene::loadCache(const std::string &filename, uint64_t key) {
+    Timer timer;
+    CacheReader reader(filename, key);
+    if (!reader.isValid())
+        return false;
+
+    try {
+        m_accel->load(reader);
+        for (Mesh *mesh : m_meshes) {
+            if (!mesh->isEmitter())
+                continue;
+            std::vector<float> areas;
+            reader.read(areas);
+            if (areas.size() != mesh->getTriangleCount())
+                throw NoriException("the sampling table of mesh \"%s\" does not match", mesh->getName());
+            mesh->setTriangleAreas(std::move(areas));
+        }
+    } catch (const std::exception &e) {
+        cerr << "Warning: ignoring the scene cache \"" << filename << "\": " << e.what() << endl;
+        return false;
+    }
+
+    cout << "Scene cache: loaded \"" << filename << "\" (" << memString(reader.getSize())
+         << ") in " << timer.elapsedString() << endl;
+    return true;
+}
+
+void Scene::saveCache(const std::string &filename, uint64_t key) const {
+    try {
+        CacheWriter writer(filename, key);
+        m_accel->save(writer);
+        for (const Mesh *mesh : m_meshes) {
+            if (!mesh->isEmitter())
+                continue;
+            writer.write(mesh->computeTriangleAreas());
+        }
+        writer.commit();
+        cout << "Scene cache: wrote \"" << filename << "\"" << endl;
+    } catch (const std::exception &e) {
+        cerr << "Warning: could not write the scene cache: " << e.what() << endl;
+    }
+}
+
+const Emitter *Scene::sampleEmitterPower(float sample, float &pmf) const {
+    pmf = 0.0f;
+    if (!m_powerTable.isNormalized())
+        return nullptr;
+    return m_emitters[m_powerTable.sample(sample, pmf)];
+}
+
+float Scene::pdfEmitterPower(const Emitter *emitter) const {
+    auto it = m_emitterIndex.find(emitter);
+    if (it == m_emitterIndex.end() || !m_powerTable.isNormalized())
+        return 0.0f;
+    return m_powerTable[it->second];
+}
+
+void Scene::setEmitterSampling(const std::string &strategy) {
+    if (strategy != "power" && strategy != "luminance" && strategy != "bvh")
+        throw NoriException("Scene: unknown emitterSampling \"%s\" (expected \"power\", \"luminance\" or \"bvh\")",
+            strategy);
+    m_emitterSampling = strategy;
+}
+
+void Scene::buildEmitterSampling() {
+    delete m_lightBVH;
+    m_lightBVH = nullptr;
+
+    /* Emitter power (radiance x area x pi), computed once for every strategy
+       since paths that start on the emitters always choose them by power;
+       without it fall back to luminance */
+    bool havePower = true;
+    for (Emitter *emitter : m_emitters) {
+        /* A black emitter has zero power (and is never chosen), not an unknown one */
+        if (!emitter->hasPower())
+            havePower = false;
+        else if (emitter->getPower() <= 0.0f)
+            emitter->computePower();
+    }
+    if (!havePower && !m_emitters.empty())
+        cout << "Emitter selection: power unavailable for some emitter, using luminance" << endl;
+
+    m_powerTable.clear();
+    m_powerTable.reserve(m_emitters.size());
+    for (const Emitter *emitter : m_emitters)
+        m_powerTable.append(havePower ? emitter->getPower() : emitter->getLuminance());
+    m_powerTable.normalize();
+
+    // Tabla alias para la seleccion de emisores
+    bool usePower = m_emitterSampling == "power" && havePower;
+    dpdf.clear();
+    dpdf.reserve(m_emitters.size());
+    for (int i = 0; i < m_emitters.size(); ++i)
+    {
+        dpdf.append(usePower ? m_emitters[i]->getPower() : m_emitters[i]->getLuminance());
+    }
+    dpdf.normalize();
+
+    m_emitterIndex.clear();
+    for (uint32_t i = 0; i < (uint32_t) m_emitters.size(); ++i)
+        m_emitterIndex[m_emitters[i]] = i;
+
+    if (m_emitterSampling == "bvh") {
+        /* Many-light sampling: only emitters attached to meshes can go into the hierarchy */
+        size_t meshEmitters = 0;
+        for (const Mesh *mesh : m_meshes)
+            meshEmitters += mesh->isEmitter();
+        if (meshEmitters != m_emitters.size())
+            throw NoriException("Scene: emitterSampling=\"bvh\" only supports emitters attached to meshes");
+
+        Timer timer;
+        m_lightBVH = new LightBVH(m_meshes);
+        cout << "Light BVH: " << m_lightBVH->getTriangleCount() << " emitter triangles, "
+             << m_lightBVH->getNodeCount() << " nodes, " << memString(m_lightBVH->getMemory())
+             << ", built in " << timer.elapsedString() << endl;
+    }
+}
+
 void Scene::activate() {
-    m_accel->build();
+    /* Restore the hierarchy and the emitter sampling tables from the
+       cache if the meshes and build settings did not change */
+    std::string cacheFile;
+    uint64_t cacheKey = 0;
+    if (!m_cacheFile.empty()) {
+        filesystem::path path(m_cacheFile);
+        if (!path.is_absolute() && getFileResolver()->size() > 0)
+            path = (*getFileResolver())[0] / path;
+        cacheFile = path.str();
+        cacheKey = getCacheKey();
+    }
+
+    if (cacheFile.empty() || !loadCache(cacheFile, cacheKey)) {
+        m_accel->build();
+        if (!cacheFile.empty())
+            saveCache(cacheFile, cacheKey);
+    }
 
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
@@ -79,19 +301,27 @@ void Scene::activate() {
         throw NoriException("No camera was specified!");
     
     if (!m_sampler) {
-        /* Create a default (independent) sampler */
+        /* Create a default (scrambled Sobol) sampler */
         m_sampler = static_cast<Sampler*>(
-            NoriObjectFactory::createInstance("independent", PropertyList()));
+            NoriObjectFactory::createInstance("sobol", PropertyList()));
     }
 
-    // Activar DiscretePDF de Nori
-    dpdf.clear();
-    dpdf.reserve(m_emitters.size());
-    for (int i = 0; i < m_emitters.size(); ++i)
-    {
-        dpdf.append(m_emitters[i]->getLuminance());
+    buildEmitterSampling();
+
+    /* The triangle sampling tables of emitter meshes are built on first use;
+       other meshes never get one */
+    size_t emitterMeshes = 0, emitterTriangles = 0, otherTriangles = 0;
+    for (const Mesh *mesh : m_meshes) {
+        if (mesh->isEmitter()) {
+            emitterMeshes++;
+            emitterTriangles += mesh->getTriangleCount();
+        } else {
+            otherTriangles += mesh->getTriangleCount();
+        }
     }
-    dpdf.normalize();
+    cout << tfm::format("Emitter sampling tables: %i meshes (%i triangles), built on first use; "
+        "none for %i non-emitting triangles (saves %s)", emitterMeshes, emitterTriangles,
+        otherTriangles, memString(otherTriangles * AliasTable::getEntrySize())) << endl;
 
     cout << endl;
     cout << "Configuration: " << toString() << endl;
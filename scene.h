@@ -20,7 +20,9 @@
 
 #include <nori/accel.h>
 #include <nori/emitter.h>
-#include <nori/dpdf.h>
+#include <nori/alias.h>
+#include <nori/lightbvh.h>
+#include <atomic>
 
 NORI_NAMESPACE_BEGIN
 
@@ -60,9 +62,70 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
-    // Permite obtener una muestra en las luces de la escena
+    /**
+     * \brief Sample a point on the emitters of the scene as seen from \c lRec.ref
+     *
+     * Emitters are chosen according to the \c emitterSampling property of
+     * the scene: \c "power" (default) picks an emitter in proportion to
+     * its emitted power (\ref Emitter::getPower(), falling back to the
+     * luminance if some emitter cannot report it), \c "luminance" in
+     * proportion to its radiance luminance, \c "bvh" descends a \ref LightBVH over all the
+     * emitting triangles, guided by \c lRec.ref and \c lRec.refN.
+     *
+     * On return \c lRec.pdf holds the solid angle density of the sample,
+     * including the probability of choosing its emitter (see \ref pdfEmitter())
+     *
+     * \return Emitted radiance divided by the density, zero if occluded
+     */
     const Color3f sampleEmitter(EmitterQueryRecord& lRec, const Point2f &sample) const;
 
+    /**
+     * \brief Solid angle density with which \ref sampleEmitter() produces
+     * the emitter point \c its from \c ref (shading normal \c refN)
+     *
+     * Used to compute the MIS weight of emitters found by BSDF sampling.
+     */
+    float pdfEmitter(const Point3f &ref, const Normal3f &refN, const Intersection &its) const;
+
+    /**
+     * \brief Choose an emitter in proportion to its power, for paths that
+     * start on the emitters (photons, light subpaths)
+     *
+     * Unlike \ref sampleEmitter() this does not depend on \c emitterSampling.
+     * Falls back to the luminance if some emitter cannot report its power.
+     *
+     * \param pmf
+     *    Probability of the chosen emitter
+     * \return
+     *    The emitter, \c nullptr if the scene has none that emits
+     */
+    const Emitter *sampleEmitterPower(float sample, float &pmf) const;
+
+    /// Probability with which \ref sampleEmitterPower() chooses \c emitter
+    float pdfEmitterPower(const Emitter *emitter) const;
+
+    /**
+     * \brief Switch the emitter selection strategy (\c "power",
+     * \c "luminance" or \c "bvh")
+     *
+     * Takes effect in \ref activate(), or immediately after a call to
+     * \ref buildEmitterSampling()
+     */
+    void setEmitterSampling(const std::string &strategy);
+
+    /// Build the emitter selection structures of the current strategy
+    void buildEmitterSampling();
+
+    /**
+     * \brief Same as \ref sampleEmitter() but without the visibility test
+     *
+     * Used by batched integrators that trace all their shadow rays in a
+     * separate stage. The shadow ray to test goes from \c lRec.ref along
+     * \c lRec.wi, between \c Epsilon and the distance to \c lRec.p minus
+     * \c Epsilon.
+     */
+    const Color3f sampleEmitterUnshadowed(EmitterQueryRecord& lRec, const Point2f &sample) const;
+
     const std::vector<Emitter*>& getEmitters() const { return m_emitters; }
 
     /**
@@ -99,8 +162,78 @@ public:
      * \return \c true if an intersection was found
      */
     bool rayIntersect(const Ray3f &ray) const {
-        Intersection its; /* Unused */
-        return m_accel->rayIntersect(ray, its, true);
+        return m_accel->rayOccluded(ray);
+    }
+
+    /**
+     * \brief Occlusion (any-hit) query for a shadow ray segment
+     *
+     * The traversal stops at the first triangle found between \c ray.mint
+     * and \c ray.maxt, and no intersection record is set up.
+     *
+     * \return \c true if the segment is blocked
+     */
+    bool rayOccluded(const Ray3f &ray) const {
+        return m_accel->rayOccluded(ray);
+    }
+
+    /// Occlusion query for a packet, returns the mask of the blocked lanes
+    template <int N>
+    uint32_t rayOccluded(const RayPacket<N> &packet) const {
+        return m_accel->rayOccludedPacket<N>(packet);
+    }
+
+    /**
+     * \brief Occlusion query for a stream of shadow rays
+     *
+     * Consecutive rays are traced together as packets. The number of rays
+     * and the time spent are added to the occlusion statistics of the
+     * scene (see \ref getOcclusionRayCount()).
+     *
+     * \param occluded
+     *    Resized to the number of rays, entry \c i is set if ray \c i is blocked
+     */
+    void rayOccluded(const RayQueue &rays, std::vector<uint8_t> &occluded) const;
+
+    /// Number of shadow rays traced by stream occlusion queries so far
+    uint64_t getOcclusionRayCount() const { return m_occlusionRays; }
+
+    /// Time spent in stream occlusion queries so far, summed over threads (in seconds)
+    double getOcclusionTime() const { return m_occlusionTime * 1e-9; }
+
+    /**
+     * \brief Intersect a packet of coherent rays (4, 8 or 16 wide) against
+     * all triangles stored in the scene
+     *
+     * \param packet
+     *    Rays to intersect, see \ref RayPacket
+     *
+     * \param hit
+     *    Closest hit of each lane. Use \ref Accel::fillIntersection() to
+     *    obtain the detailed record of a lane
+     */
+    template <int N>
+    void rayIntersect(const RayPacket<N> &packet, PacketHit<N> &hit) const {
+        m_accel->rayIntersectPacket<N>(packet, hit);
+    }
+
+    /**
+     * \brief Intersect a stream of rays against all triangles stored in the
+     * scene. Consecutive rays are traced together as packets.
+     *
+     * \param rays
+     *    Rays to intersect
+     *
+     * \param hits
+     *    Resized to the number of rays, receives the hit of each one
+     */
+    void rayIntersect(const RayQueue &rays, HitQueue &hits) const {
+        m_accel->rayIntersectStream(rays, hits);
+    }
+
+    /// Detailed intersection record of entry \c i of a stream query
+    void getIntersection(const HitQueue &hits, size_t i, Intersection &its) const {
+        m_accel->fillIntersection(hits.prim[i], hits.u[i], hits.v[i], hits.t[i], its);
     }
 
     /// \brief Return an axis-aligned box that bounds the scene
@@ -124,13 +257,29 @@ public:
 
     EClassType getClassType() const { return EScene; }
 private:
+    /// Key of the scene cache: mesh contents and acceleration build settings
+    uint64_t getCacheKey() const;
+
+    /// Restore the hierarchy and emitter sampling tables, \c false if the cache is missing or stale
+    bool loadCache(const std::string &filename, uint64_t key);
+
+    /// Write the hierarchy and emitter sampling tables to the cache
+    void saveCache(const std::string &filename, uint64_t key) const;
+
     std::vector<Mesh *> m_meshes;
     std::vector<Emitter*> m_emitters;
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
     Accel *m_accel = nullptr;
-    DiscretePDF dpdf;
+    AliasTable dpdf;          ///< Emitter selection
+    AliasTable m_powerTable;  ///< Emitter selection by power, whatever the strategy
+    std::unordered_map<const Emitter *, uint32_t> m_emitterIndex;  ///< Entry of every emitter in \c dpdf
+    std::string m_emitterSampling;      ///< \c "power", \c "luminance" or \c "bvh"
+    LightBVH *m_lightBVH = nullptr;     ///< Emitter triangle hierarchy (\c "bvh" sampling only)
+    std::string m_cacheFile;  ///< Scene cache file (empty: no cache)
+    mutable std::atomic<uint64_t> m_occlusionRays{ 0 };
+    mutable std::atomic<uint64_t> m_occlusionTime{ 0 };  ///< nanoseconds
 };
 
 NORI_NAMESPACE_END
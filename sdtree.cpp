@@ -0,0 +1,269 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sdtree.h>
+#include <nori/warp.h>
+
+#if !defined(NORI_ONE_MINUS_EPSILON)
+#define NORI_ONE_MINUS_EPSILON 0.99999994f
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    inline void atomicAdd(std::atomic<float> &target, float value) {
+        float current = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+            ;
+    }
+
+    /// Direction to cylindrical coordinates in [0, 1)^2
+    inline Point2f dirToCanonical(const Vector3f &d) {
+        float cosTheta = std::min(std::max(d.z(), -1.f), 1.f);
+        float phi = std::atan2(d.y(), d.x());
+        if (phi < 0.f)
+            phi += 2.f * M_PI;
+        return Point2f(std::min((cosTheta + 1.f) * 0.5f, NORI_ONE_MINUS_EPSILON),
+                       std::min(phi * INV_TWOPI, NORI_ONE_MINUS_EPSILON));
+    }
+
+    inline Vector3f canonicalToDir(const Point2f &p) {
+        float cosTheta = 2.f * p.x() - 1.f;
+        float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+        float phi = 2.f * M_PI * p.y();
+        return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+
+    /// Quadrant of \c p in the unit square, and \c p moved into that quadrant's unit square
+    inline int quadrant(Point2f &p) {
+        int x = p.x() >= 0.5f, y = p.y() >= 0.5f;
+        p = Point2f(std::min(2.f * p.x() - x, NORI_ONE_MINUS_EPSILON),
+                    std::min(2.f * p.y() - y, NORI_ONE_MINUS_EPSILON));
+        return x + 2 * y;
+    }
+
+    /// Pick 0 with probability \c p0 and rescale \c u to a new uniform sample
+    inline int pick(float &u, float p0) {
+        if (u < p0) {
+            u = std::min(u / p0, NORI_ONE_MINUS_EPSILON);
+            return 0;
+        }
+        u = std::min((u - p0) / (1.f - p0), NORI_ONE_MINUS_EPSILON);
+        return 1;
+    }
+}
+
+DTree::Node::Node() {
+    for (int i = 0; i < 4; ++i) {
+        sum[i].store(0.f, std::memory_order_relaxed);
+        child[i] = 0;
+    }
+}
+
+DTree::Node::Node(const Node &other) {
+    *this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other) {
+    for (int i = 0; i < 4; ++i) {
+        sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[i] = other.child[i];
+    }
+    return *this;
+}
+
+float DTree::Node::getTotal() const {
+    float total = 0.f;
+    for (int i = 0; i < 4; ++i)
+        total += sum[i].load(std::memory_order_relaxed);
+    return total;
+}
+
+DTree::DTree() : m_nodes(1) { }
+
+void DTree::record(const Vector3f &d, float value) {
+    if (!(value > 0.f) || !std::isfinite(value))
+        return;
+    Point2f p = dirToCanonical(d);
+    uint32_t node = 0;
+    while (true) {
+        Node &n = m_nodes[node];
+        int i = quadrant(p);
+        atomicAdd(n.sum[i], value);
+        if (!n.child[i])
+            break;
+        node = n.child[i];
+    }
+}
+
+Vector3f DTree::sample(Point2f sample) const {
+    if (!(getTotal() > 0.f))
+        return Warp::squareToUniformSphere(sample);
+
+    Point2f origin(0.f, 0.f);
+    float size = 1.f;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = m_nodes[node];
+        float s[4];
+        for (int i = 0; i < 4; ++i)
+            s[i] = n.sum[i].load(std::memory_order_relaxed);
+        float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0.f))
+            break;
+
+        /* Bottom or top half, then left or right quadrant */
+        int y = pick(sample.y(), (s[0] + s[1]) / total);
+        float row = s[2 * y] + s[2 * y + 1];
+        int x = pick(sample.x(), row > 0.f ? s[2 * y] / row : 0.5f);
+        int i = x + 2 * y;
+
+        size *= 0.5f;
+        origin += Point2f(x * size, y * size);
+        if (!n.child[i])
+            break;
+        node = n.child[i];
+    }
+    return canonicalToDir(origin + sample * size);
+}
+
+float DTree::pdf(const Vector3f &d) const {
+    if (!(getTotal() > 0.f))
+        return INV_FOURPI;
+
+    Point2f p = dirToCanonical(d);
+    float factor = 1.f;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = m_nodes[node];
+        float total = n.getTotal();
+        if (!(total > 0.f))
+            break;
+        int i = quadrant(p);
+        factor *= 4.f * n.sum[i].load(std::memory_order_relaxed) / total;
+        if (!n.child[i] || factor == 0.f)
+            break;
+        node = n.child[i];
+    }
+    return factor * INV_FOURPI;
+}
+
+DTree DTree::refined(float threshold, int maxDepth) const {
+    DTree result;
+    float total = getTotal();
+    if (!(total > 0.f))
+        return result;
+
+    /* Node of the result, node of this tree covering the same region
+       (-1 below a leaf of this tree), energy of the region and depth */
+    struct Entry { uint32_t node; int64_t source; float energy; int depth; };
+    std::vector<Entry> stack(1, Entry { 0, 0, total, 1 });
+    while (!stack.empty()) {
+        Entry e = stack.back();
+        stack.pop_back();
+        for (int i = 0; i < 4; ++i) {
+            float energy = e.source >= 0 ? m_nodes[e.source].sum[i].load(std::memory_order_relaxed) : e.energy * 0.25f;
+            if (!(energy > threshold * total) || e.depth >= maxDepth)
+                continue;
+            int64_t source = e.source >= 0 && m_nodes[e.source].child[i] ? (int64_t) m_nodes[e.source].child[i] : -1;
+            uint32_t child = (uint32_t) result.m_nodes.size();
+            result.m_nodes.emplace_back();
+            result.m_nodes[e.node].child[i] = child;
+            stack.push_back(Entry { child, source, energy, e.depth + 1 });
+        }
+    }
+    return result;
+}
+
+SDTree::Leaf::Leaf(const Leaf &other)
+    : sampling(other.sampling), building(other.building),
+      count(other.count.load(std::memory_order_relaxed)) { }
+
+SDTree::SDTree(const BoundingBox3f &bbox) {
+    /* Cube around the scene, so that the cells stay close to cubes */
+    Vector3f extents = bbox.getExtents();
+    float size = std::max(extents.maxCoeff(), Epsilon) * 1.001f;
+    m_bbox = BoundingBox3f(bbox.min, bbox.min + Vector3f::Constant(size));
+
+    m_nodes.push_back(Node { { 0, 0 }, 0, 0 });
+    m_leaves.emplace_back();
+}
+
+SDTree::Leaf &SDTree::lookup(const Point3f &p_) {
+    Vector3f p = (p_ - m_bbox.min).cwiseQuotient(m_bbox.getExtents());
+    uint32_t node = 0;
+    while (m_nodes[node].child[0]) {
+        const Node &n = m_nodes[node];
+        float &x = p[n.axis];
+        if (x < 0.5f) {
+            x *= 2.f;
+            node = n.child[0];
+        } else {
+            x = 2.f * x - 1.f;
+            node = n.child[1];
+        }
+    }
+    return m_leaves[m_nodes[node].leaf];
+}
+
+void SDTree::refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth) {
+    /* Spatial subdivision */
+    std::vector<uint32_t> stack;
+    for (uint32_t i = 0; i < (uint32_t) m_nodes.size(); ++i)
+        if (!m_nodes[i].child[0])
+            stack.push_back(i);
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        Leaf &leaf = m_leaves[m_nodes[node].leaf];
+        uint32_t count = leaf.count.load(std::memory_order_relaxed);
+        if (count <= spatialThreshold)
+            continue;
+
+        /* Both halves start with the distributions of the parent */
+        leaf.count.store(count / 2, std::memory_order_relaxed);
+        uint32_t first = m_nodes[node].leaf, second = (uint32_t) m_leaves.size();
+        Leaf copy(m_leaves[first]);
+        m_leaves.push_back(copy);
+
+        uint8_t axis = (uint8_t) ((m_nodes[node].axis + 1) % 3);
+        uint32_t child = (uint32_t) m_nodes.size();
+        m_nodes.push_back(Node { { 0, 0 }, first, axis });
+        m_nodes.push_back(Node { { 0, 0 }, second, axis });
+        m_nodes[node].child[0] = child;
+        m_nodes[node].child[1] = child + 1;
+        stack.push_back(child);
+        stack.push_back(child + 1);
+    }
+
+    /* The recorded distributions become the sampling ones */
+    for (Leaf &leaf : m_leaves) {
+        leaf.sampling = leaf.building;
+        leaf.building = leaf.building.refined(directionalThreshold, maxDepth);
+        leaf.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t SDTree::getDirectionalNodeCount() const {
+    size_t count = 0;
+    for (const Leaf &leaf : m_leaves)
+        count += leaf.sampling.getNodeCount();
+    return count;
+}
+
+NORI_NAMESPACE_END
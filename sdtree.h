@@ -0,0 +1,148 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <atomic>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Directional quadtree of an \ref SDTree
+ *
+ * Subdivides the square of cylindrical coordinates (cos theta, phi) of the
+ * sphere of directions, which maps areas to solid angles uniformly. Every
+ * node keeps the energy recorded in each of its four quadrants; directions
+ * are sampled by descending in proportion to these energies, and uniformly
+ * within the leaf that is reached.
+ */
+class DTree {
+public:
+    /// A single node: uniform distribution, no energy recorded
+    DTree();
+
+    /// Add \c value to every quadrant containing the direction \c d (thread-safe)
+    void record(const Vector3f &d, float value);
+
+    /// Total energy recorded
+    float getTotal() const { return m_nodes[0].getTotal(); }
+
+    /// Sample a direction in proportion to the recorded energy (uniformly if there is none)
+    Vector3f sample(Point2f sample) const;
+
+    /// Solid angle density of \ref sample()
+    float pdf(const Vector3f &d) const;
+
+    /**
+     * \brief Structure for the next training pass
+     *
+     * The quadrants holding more than \c threshold of the total energy are
+     * subdivided (down to \c maxDepth levels), the others become leaves.
+     * The energies of the result are zero.
+     */
+    DTree refined(float threshold, int maxDepth) const;
+
+    /// Number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+private:
+    struct Node {
+        std::atomic<float> sum[4];
+        /// Node of every quadrant, 0 for the leaves
+        uint32_t child[4];
+
+        Node();
+        Node(const Node &other);
+        Node &operator=(const Node &other);
+
+        float getTotal() const;
+    };
+
+    std::vector<Node> m_nodes;
+};
+
+/**
+ * \brief Spatial-directional radiance cache of the "path_guided" integrator
+ *
+ * "Practical Path Guiding" (Mueller et al. 2017): a binary tree over the
+ * bounding cube of the scene, split at the middle along x, y and z in
+ * turn, with two \ref DTree in every leaf. One holds the incident radiance
+ * learnt by the previous training pass and is sampled from; the other
+ * records the radiance found by the current one. After each pass
+ * \ref refine() splits the leaves that received many records and swaps
+ * the trees.
+ */
+class SDTree {
+public:
+    struct Leaf {
+        /// Distribution to sample from
+        DTree sampling;
+        /// Distribution being learnt
+        DTree building;
+        /// Records received by \c building
+        std::atomic<uint32_t> count;
+
+        Leaf() : count(0) { }
+        Leaf(const Leaf &other);
+
+        /// Record the radiance arriving from \c d (weighted by one over its sampling density)
+        void record(const Vector3f &d, float value) {
+            building.record(d, value);
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    SDTree(const BoundingBox3f &bbox);
+
+    /// Leaf containing \c p
+    Leaf &lookup(const Point3f &p);
+
+    /**
+     * \brief End of a training pass
+     *
+     * Splits the leaves that received more than \c spatialThreshold
+     * records (each half is assumed to get half of them), then turns the
+     * recorded trees into the sampling trees and starts new ones with
+     * \ref DTree::refined().
+     */
+    void refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth);
+
+    /// Number of spatial leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Total number of directional nodes
+    size_t getDirectionalNodeCount() const;
+
+private:
+    struct Node {
+        /// Children of an inner node (0 for a leaf)
+        uint32_t child[2];
+        /// Leaf data of a leaf node
+        uint32_t leaf;
+        /// Split axis
+        uint8_t axis;
+    };
+
+    BoundingBox3f m_bbox;
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,220 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/block.h>
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Generator matrix of the second Sobol dimension (the first one is the bit reversal)
+    struct SobolMatrix {
+        uint32_t v[32];
+        SobolMatrix() {
+            v[0] = 1u << 31;
+            for (int i = 1; i < 32; ++i)
+                v[i] = v[i - 1] ^ (v[i - 1] >> 1);
+        }
+    };
+    const SobolMatrix sobolMatrix;
+
+    inline uint32_t reverseBits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    /// Second component of the Sobol point \c index
+    inline uint32_t sobol1(uint32_t index) {
+        uint32_t x = 0;
+        for (int bit = 0; index; ++bit, index >>= 1) {
+            if (index & 1)
+                x ^= sobolMatrix.v[bit];
+        }
+        return x;
+    }
+
+    inline uint32_t hash(uint32_t x) {
+        x ^= x >> 16; x *= 0x7feb352du;
+        x ^= x >> 15; x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+        return seed ^ (hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+    }
+
+    /**
+     * \brief Nested uniform (Owen) scramble of a 32-bit fixed point value,
+     * with the hash of Laine and Karras as in Burley's "Practical hash-based
+     * Owen scrambling" (JCGT 2020)
+     */
+    inline uint32_t owenScramble(uint32_t x, uint32_t seed) {
+        x = reverseBits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverseBits(x);
+    }
+
+    inline float toFloat(uint32_t x) {
+        return (x >> 8) * (1.f / (1u << 24));
+    }
+}
+
+/**
+ * \brief Owen-scrambled Sobol sampler
+ *
+ * Every \ref next1D() or \ref next2D() call of a pixel sample is a new
+ * dimension of a padded (0,2)-sequence: the first two Sobol dimensions,
+ * Owen-scrambled and with the sample index shuffled by a seed that depends
+ * on the pixel and on the dimension. Since the integrators draw their
+ * numbers in a fixed order (Russian roulette, emitter, BSDF, ... at each
+ * bounce), the same dimension always feeds the same decision, and every
+ * one of them is stratified over the samples of a pixel, while different
+ * dimensions and pixels stay decorrelated. Sample counts that are powers
+ * of two give the best stratification.
+ *
+ * Pixels are identified following the protocol of \ref Sampler: the block
+ * is visited in scanline order, with a call to \ref generate() when a new
+ * pixel starts and one to \ref advance() after each of its samples. When
+ * the whole block is run one sample index at a time (batched integrators),
+ * \ref generate() is called for every pixel of every pass instead, and a
+ * call past the last pixel starts the next sample index. The batched
+ * integrators then save the state of each pixel sample after its camera
+ * samples (\ref getState()) and restore it around the draws of its path
+ * (\ref setState()), so the later dimensions stay stratified per pixel.
+ */
+class Sobol : public Sampler {
+public:
+    Sobol(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    virtual ~Sobol() { }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Sobol> cloned(new Sobol());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_sampleOffset = m_sampleOffset;
+        cloned->m_seed = m_seed;
+        cloned->m_offset = m_offset;
+        cloned->m_width = m_width;
+        cloned->m_pixelCount = m_pixelCount;
+        cloned->m_pixel = m_pixel;
+        cloned->m_pass = m_pass;
+        cloned->m_sampleIndex = m_sampleIndex;
+        cloned->m_pixelSeed = m_pixelSeed;
+        cloned->m_dimension = m_dimension;
+        cloned->m_generated = m_generated;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &block) {
+        m_offset = block.getOffset();
+        m_width = std::max(block.getSize().x(), 1);
+        m_pixelCount = (uint32_t) m_width * (uint32_t) std::max(block.getSize().y(), 1);
+        m_pixel = 0;
+        m_pass = 0;
+        m_sampleIndex = m_sampleOffset;
+        m_dimension = 0;
+        m_generated = false;
+        seedPixel();
+    }
+
+    void generate() {
+        /* The first call starts the first pixel, later ones move on */
+        if (m_generated && ++m_pixel >= m_pixelCount) {
+            m_pixel = 0;
+            m_pass++;
+        }
+        m_generated = true;
+        m_sampleIndex = m_sampleOffset + m_pass;
+        m_dimension = 0;
+        seedPixel();
+    }
+
+    void advance() {
+        m_sampleIndex++;
+        m_dimension = 0;
+    }
+
+    float next1D() {
+        uint32_t seed = hashCombine(m_pixelSeed, m_dimension++);
+        uint32_t index = owenScramble(m_sampleIndex, seed);
+        return toFloat(owenScramble(reverseBits(index), hashCombine(seed, 0)));
+    }
+
+    Point2f next2D() {
+        uint32_t seed = hashCombine(m_pixelSeed, m_dimension++);
+        uint32_t index = owenScramble(m_sampleIndex, seed);
+        return Point2f(
+            toFloat(owenScramble(reverseBits(index), hashCombine(seed, 0))),
+            toFloat(owenScramble(sobol1(index), hashCombine(seed, 1)))
+        );
+    }
+
+    SamplerState getState() const {
+        SamplerState state;
+        state.seed = m_pixelSeed;
+        state.index = m_sampleIndex;
+        state.dimension = m_dimension;
+        return state;
+    }
+
+    void setState(const SamplerState &state) {
+        m_pixelSeed = state.seed;
+        m_sampleIndex = state.index;
+        m_dimension = state.dimension;
+    }
+
+    std::string toString() const {
+        return tfm::format("Sobol[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+
+protected:
+    Sobol() { }
+
+private:
+    /// Seed of the current pixel, from its image coordinates
+    void seedPixel() {
+        int x = m_offset.x() + (int) (m_pixel % (uint32_t) m_width);
+        int y = m_offset.y() + (int) (m_pixel / (uint32_t) m_width);
+        m_pixelSeed = hashCombine(hashCombine(hash(m_seed), (uint32_t) x), (uint32_t) y);
+    }
+
+    uint32_t m_seed = 0;
+    Point2i m_offset = Point2i(0, 0);
+    int m_width = 1;
+    uint32_t m_pixelCount = 1;
+    /// Pixel of the block (scanline order), pass over the block and sample index
+    uint32_t m_pixel = 0, m_pass = 0, m_sampleIndex = 0;
+    uint32_t m_pixelSeed = 0;
+    /// Number of components drawn from the current sample
+    uint32_t m_dimension = 0;
+    bool m_generated = false;
+};
+
+NORI_REGISTER_CLASS(Sobol, "sobol");
+NORI_NAMESPACE_END
@@ -0,0 +1,233 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/ray.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/// Number of triangles per block: one AVX register or one SSE register
+#if defined(__AVX2__)
+#define NORI_TRIBLOCK_WIDTH 8
+#else
+#define NORI_TRIBLOCK_WIDTH 4
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Precomputed data of up to \c NORI_TRIBLOCK_WIDTH triangles
+ *
+ * Built once by \ref Accel::build(): the first vertex and the two edges of
+ * each triangle are stored as structure-of-arrays, so a ray is tested
+ * against the whole block with one vector operation per step of
+ * Moeller-Trumbore and without going back to the mesh index and vertex
+ * buffers. Unused lanes hold a degenerate triangle that never intersects.
+ */
+struct alignas(32) TriangleBlock {
+    enum { Width = NORI_TRIBLOCK_WIDTH };
+
+    float p0x[Width], p0y[Width], p0z[Width];
+    float e1x[Width], e1y[Width], e1z[Width];
+    float e2x[Width], e2y[Width], e2z[Width];
+    /// Primitive index of each lane (NORI_INVALID_PRIM for unused lanes)
+    uint32_t prim[Width];
+
+    /// Fill all the lanes with degenerate triangles
+    void clear() {
+        for (int i = 0; i < Width; ++i) {
+            p0x[i] = p0y[i] = p0z[i] = 0.f;
+            e1x[i] = e1y[i] = e1z[i] = 0.f;
+            e2x[i] = e2y[i] = e2z[i] = 0.f;
+            prim[i] = (uint32_t) -1;
+        }
+    }
+
+    /// Store triangle (p0, p1, p2) in lane \c i
+    void set(int i, const Point3f &p0, const Point3f &p1, const Point3f &p2, uint32_t primIdx) {
+        Vector3f e1 = p1 - p0, e2 = p2 - p0;
+        p0x[i] = p0.x(); p0y[i] = p0.y(); p0z[i] = p0.z();
+        e1x[i] = e1.x(); e1y[i] = e1.y(); e1z[i] = e1.z();
+        e2x[i] = e2.x(); e2y[i] = e2.y(); e2z[i] = e2.z();
+        prim[i] = primIdx;
+    }
+
+    /**
+     * \brief Intersect a ray against all the triangles of the block
+     *
+     * Performs the same tests as \ref Mesh::rayIntersect() on every lane.
+     *
+     * \param ray
+     *    The ray segment, \c ray.maxt bounds the accepted distances
+     * \param u, v, t
+     *    Upon success, barycentric coordinates and distance of the closest hit
+     * \param anyHit
+     *    Return the first lane found instead of the closest one
+     * \return
+     *    The lane of the hit, or -1
+     */
+    int rayIntersect(const Ray3f &ray, float &u, float &v, float &t, bool anyHit = false) const;
+
+private:
+    /// Pick the closest of the lanes set in \c bits and export its hit
+    static int closestLane(int bits, const float *tl, const float *ul, const float *vl,
+            float &uOut, float &vOut, float &tOut, bool anyHit) {
+        int best = -1;
+        for (int i = 0; i < Width; ++i) {
+            if (!(bits & (1 << i)) || (best >= 0 && tl[i] >= tl[best]))
+                continue;
+            best = i;
+            if (anyHit)
+                break;
+        }
+        uOut = ul[best]; vOut = vl[best]; tOut = tl[best];
+        return best;
+    }
+};
+
+#if defined(__AVX2__)
+
+inline int TriangleBlock::rayIntersect(const Ray3f &ray, float &uOut, float &vOut, float &tOut, bool anyHit) const {
+    const __m256 dx = _mm256_set1_ps(ray.d.x()), dy = _mm256_set1_ps(ray.d.y()), dz = _mm256_set1_ps(ray.d.z());
+    const __m256 e1x_ = _mm256_load_ps(e1x), e1y_ = _mm256_load_ps(e1y), e1z_ = _mm256_load_ps(e1z);
+    const __m256 e2x_ = _mm256_load_ps(e2x), e2y_ = _mm256_load_ps(e2y), e2z_ = _mm256_load_ps(e2z);
+
+    /* pvec = d x e2, det = e1 . pvec */
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z_), _mm256_mul_ps(dz, e2y_));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x_), _mm256_mul_ps(dx, e2z_));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y_), _mm256_mul_ps(dy, e2x_));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x_, px), _mm256_mul_ps(e1y_, py)), _mm256_mul_ps(e1z_, pz));
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+    /* tvec = o - p0, u = tvec . pvec */
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.o.x()), _mm256_load_ps(p0x));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.o.y()), _mm256_load_ps(p0y));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.o.z()), _mm256_load_ps(p0z));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+
+    /* qvec = tvec x e1, v = d . qvec, t = e2 . qvec */
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z_), _mm256_mul_ps(tz, e1y_));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x_), _mm256_mul_ps(tx, e1z_));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y_), _mm256_mul_ps(ty, e1x_));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x_, qx), _mm256_mul_ps(e2y_, qy)), _mm256_mul_ps(e2z_, qz)), invDet);
+
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+    __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.f), det);
+    __m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(ray.mint), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(ray.maxt), _CMP_LE_OQ));
+
+    int bits = _mm256_movemask_ps(mask);
+    if (!bits)
+        return -1;
+
+    alignas(32) float tl[Width], ul[Width], vl[Width];
+    _mm256_store_ps(tl, t); _mm256_store_ps(ul, u); _mm256_store_ps(vl, v);
+    return closestLane(bits, tl, ul, vl, uOut, vOut, tOut, anyHit);
+}
+
+#elif defined(__SSE2__)
+
+inline int TriangleBlock::rayIntersect(const Ray3f &ray, float &uOut, float &vOut, float &tOut, bool anyHit) const {
+    const __m128 dx = _mm_set1_ps(ray.d.x()), dy = _mm_set1_ps(ray.d.y()), dz = _mm_set1_ps(ray.d.z());
+    const __m128 e1x_ = _mm_load_ps(e1x), e1y_ = _mm_load_ps(e1y), e1z_ = _mm_load_ps(e1z);
+    const __m128 e2x_ = _mm_load_ps(e2x), e2y_ = _mm_load_ps(e2y), e2z_ = _mm_load_ps(e2z);
+
+    /* pvec = d x e2, det = e1 . pvec */
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z_), _mm_mul_ps(dz, e2y_));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x_), _mm_mul_ps(dx, e2z_));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y_), _mm_mul_ps(dy, e2x_));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x_, px), _mm_mul_ps(e1y_, py)), _mm_mul_ps(e1z_, pz));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    /* tvec = o - p0, u = tvec . pvec */
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.o.x()), _mm_load_ps(p0x));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.o.y()), _mm_load_ps(p0y));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.o.z()), _mm_load_ps(p0z));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+    /* qvec = tvec x e1, v = d . qvec, t = e2 . qvec */
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z_), _mm_mul_ps(tz, e1y_));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x_), _mm_mul_ps(tx, e1z_));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y_), _mm_mul_ps(ty, e1x_));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x_, qx), _mm_mul_ps(e2y_, qy)), _mm_mul_ps(e2z_, qz)), invDet);
+
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+    __m128 mask = _mm_cmpge_ps(absDet, _mm_set1_ps(1e-8f));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(t, _mm_set1_ps(ray.mint)));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(ray.maxt)));
+
+    int bits = _mm_movemask_ps(mask);
+    if (!bits)
+        return -1;
+
+    alignas(16) float tl[Width], ul[Width], vl[Width];
+    _mm_store_ps(tl, t); _mm_store_ps(ul, u); _mm_store_ps(vl, v);
+    return closestLane(bits, tl, ul, vl, uOut, vOut, tOut, anyHit);
+}
+
+#else
+
+inline int TriangleBlock::rayIntersect(const Ray3f &ray, float &uOut, float &vOut, float &tOut, bool anyHit) const {
+    int bits = 0;
+    float tl[Width], ul[Width], vl[Width];
+
+    for (int i = 0; i < Width; ++i) {
+        float px = ray.d.y() * e2z[i] - ray.d.z() * e2y[i];
+        float py = ray.d.z() * e2x[i] - ray.d.x() * e2z[i];
+        float pz = ray.d.x() * e2y[i] - ray.d.y() * e2x[i];
+        float det = e1x[i] * px + e1y[i] * py + e1z[i] * pz;
+        float invDet = 1.0f / det;
+
+        float tx = ray.o.x() - p0x[i], ty = ray.o.y() - p0y[i], tz = ray.o.z() - p0z[i];
+        float u = (tx * px + ty * py + tz * pz) * invDet;
+
+        float qx = ty * e1z[i] - tz * e1y[i];
+        float qy = tz * e1x[i] - tx * e1z[i];
+        float qz = tx * e1y[i] - ty * e1x[i];
+        float v = (ray.d.x() * qx + ray.d.y() * qy + ray.d.z() * qz) * invDet;
+        float t = (e2x[i] * qx + e2y[i] * qy + e2z[i] * qz) * invDet;
+
+        bool found = std::abs(det) >= 1e-8f && u >= 0.f && u <= 1.f && v >= 0.f &&
+            u + v <= 1.f && t >= ray.mint && t <= ray.maxt;
+        bits |= (int) found << i;
+        tl[i] = t; ul[i] = u; vl[i] = v;
+    }
+
+    if (!bits)
+        return -1;
+    return closestLane(bits, tl, ul, vl, uOut, vOut, tOut, anyHit);
+}
+
+#endif
+
+NORI_NAMESPACE_END
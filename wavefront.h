@@ -0,0 +1,219 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/pathtracer.h>
+#include <nori/raybatch.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Per-thread path state of the wavefront kernel
+ *
+ * Path \c i of a wave owns entry \c i of every array. All the paths of a
+ * wave are at the same depth, so the depth is not stored per path.
+ */
+struct WavefrontState {
+    /// Camera ray (index into the \ref RayBatch) each path contributes to
+    std::vector<uint32_t> pixel;
+    /// Current ray of each path
+    RayQueue rays;
+    /// Closest hit of the current ray
+    std::vector<Intersection> its;
+    /// Accumulated path throughput
+    ColorQueue throughput;
+    /// BSDF pdf of the direction that generated the current ray (< 0: not MIS weighted)
+    std::vector<float> bsdfPdf;
+    /// Shading normal at the origin of the current ray (for the emitter pdf of MIS)
+    std::vector<Normal3f> rayN;
+
+    /// Paths still alive, and the list being built by the current stage
+    std::vector<uint32_t> active, next;
+
+    /// Rays of the active paths, traced as one stream
+    RayQueue traceRays;
+    HitQueue traceHits;
+
+    /// Shadow rays queued by the shade stage, with their unoccluded contribution
+    RayQueue shadowRays;
+    std::vector<uint8_t> shadowOccluded;
+    ColorQueue shadowContrib;
+    std::vector<uint32_t> shadowPixel;
+
+    void resize(size_t size) {
+        pixel.resize(size);
+        rays.resize(size);
+        its.resize(size);
+        throughput.resize(size);
+        bsdfPdf.resize(size);
+        rayN.resize(size);
+    }
+};
+
+/**
+ * \brief Batched (wavefront) version of \ref PathKernel
+ *
+ * Instead of following one path from the camera to its end, every bounce
+ * runs each stage over all the live paths of the batch before moving on:
+ *
+ *  - generate: one path per camera ray
+ *  - intersect: closest hit of every live ray
+ *  - shade: russian roulette, emission, emitter and BSDF sampling
+ *  - shadow test: visibility of every queued emitter sample
+ *  - accumulate: add the visible contributions to their camera ray
+ *
+ * It computes the same estimator as \ref PathKernel<Policy>. Each path draws
+ * from the sampler state of its own pixel sample (\ref SamplerState), so with
+ * a stratified sampler every dimension is stratified as in the scalar kernel.
+ */
+template <typename Policy> struct WavefrontKernel {
+    static void LiBatch(const Scene *scene, Sampler *sampler, RayBatch &batch, uint64_t &reusedHits,
+            PathCounters *counters = nullptr) {
+        static thread_local WavefrontState state;
+        WavefrontState &s = state;
+
+        /* Generate */
+        size_t pathCount = batch.size();
+
+        s.resize(pathCount);
+        s.active.resize(pathCount);
+        batch.Li.resize(batch.size());
+        batch.Li.setZero();
+
+        for (size_t p = 0; p < pathCount; ++p) {
+            s.rays.set(p, batch.rays.get(p));
+            s.pixel[p] = (uint32_t) p;
+            s.throughput.set(p, Color3f(1.0f));
+            s.bsdfPdf[p] = -1.f;
+            s.active[p] = (uint32_t) p;
+        }
+
+        for (int depth = 0; !s.active.empty(); ++depth) {
+            /* Intersect: the live rays are traced as one stream of packets */
+            s.traceRays.resize(s.active.size());
+            for (size_t i = 0; i < s.active.size(); ++i)
+                s.traceRays.set(i, s.rays.get(s.active[i]));
+            scene->rayIntersect(s.traceRays, s.traceHits);
+
+            s.next.clear();
+            for (size_t i = 0; i < s.active.size(); ++i) {
+                if (!s.traceHits.hit(i))
+                    continue;
+                scene->getIntersection(s.traceHits, i, s.its[s.active[i]]);
+                s.next.push_back(s.active[i]);
+            }
+            s.active.swap(s.next);
+
+            /* Shade */
+            s.next.clear();
+            s.shadowRays.clear();
+            s.shadowContrib.clear();
+            s.shadowPixel.clear();
+
+            for (uint32_t p : s.active) {
+                const Intersection &its = s.its[p];
+                Color3f throughput = s.throughput.get(p);
+                Vector3f rayD(s.rays.dx[p], s.rays.dy[p], s.rays.dz[p]);
+                Point3f rayO(s.rays.ox[p], s.rays.oy[p], s.rays.oz[p]);
+                SamplerState &samplerState = batch.samplerStates[s.pixel[p]];
+                sampler->setState(samplerState);
+
+                if (Policy::MIS != EMISHeuristic::ENone && s.bsdfPdf[p] >= 0.f)
+                    reusedHits++;
+                if (counters)
+                    counters->vertices++;
+
+                // Ruleta rusa
+                if (Policy::RR == ERussianRoulette::ELuminance) {
+                    float probRR = std::min(throughput.getLuminance(), 1.0f);
+                    if (sampler->next1D() >= probRR)
+                        continue;
+                    throughput /= probRR;
+                }
+
+                if (its.mesh->isEmitter()) {
+                    EmitterQueryRecord eQR(rayO, its.p, its.shFrame.n);
+                    float emissionWeight = 1.f;
+                    if (Policy::NEE && s.bsdfPdf[p] >= 0.f) {
+                        if (Policy::MIS == EMISHeuristic::ENone)
+                            emissionWeight = 0.f;
+                        else
+                            emissionWeight = misWeight<Policy::MIS>(s.bsdfPdf[p],
+                                scene->pdfEmitter(rayO, s.rayN[p], its));
+                    }
+                    batch.Li.add(s.pixel[p], its.mesh->getEmitter()->eval(eQR) * throughput * emissionWeight);
+                    continue;
+                }
+
+                if (depth >= Policy::MaxDepth)
+                    continue;
+
+                const BSDF *bsdf = its.mesh->getBSDF();
+                Vector3f wi = its.toLocal(-rayD);
+
+                //EMS
+                if (Policy::NEE) {
+                    EmitterQueryRecord lRec(its.p, its.shFrame.n);
+                    Color3f lRef = scene->sampleEmitterUnshadowed(lRec, sampler->next2D());
+
+                    BSDFQueryRecord bsdfQR_EMS(wi, its.toLocal(lRec.wi), ESolidAngle);
+                    Color3f bsdfColor = bsdf->eval(bsdfQR_EMS);
+                    float cosTheta = Frame::cosTheta(its.shFrame.toLocal(lRec.wi));
+
+                    float w_ems = Policy::MIS == EMISHeuristic::ENone ? 1.f :
+                        misWeight<Policy::MIS>(lRec.pdf, bsdf->pdf(bsdfQR_EMS));
+
+                    Color3f contrib = lRef * bsdfColor * cosTheta * throughput * w_ems;
+                    if (!contrib.isZero()) {
+                        s.shadowRays.push(Ray3f(lRec.ref, lRec.wi, Epsilon, (lRec.p - lRec.ref).norm() - Epsilon));
+                        s.shadowContrib.push(contrib);
+                        s.shadowPixel.push_back(s.pixel[p]);
+                    }
+
+                    if (Policy::MIS == EMISHeuristic::ENone && depth + 1 >= Policy::MaxDepth)
+                        continue;
+                }
+
+                //BSDF
+                BSDFQueryRecord bsdfQR(wi);
+                Color3f fr = bsdf->sample(bsdfQR, sampler->next2D());
+                throughput *= fr;
+                if (throughput.isZero())
+                    continue;
+
+                s.throughput.set(p, throughput);
+                s.rays.set(p, Ray3f(its.p, its.toWorld(bsdfQR.wo)));
+                s.bsdfPdf[p] = bsdfQR.measure == EDiscrete ? -1.f : bsdf->pdf(bsdfQR);
+                s.rayN[p] = its.shFrame.n;
+                samplerState = sampler->getState();
+                s.next.push_back(p);
+            }
+            s.active.swap(s.next);
+
+            /* Shadow test + accumulate */
+            scene->rayOccluded(s.shadowRays, s.shadowOccluded);
+            for (size_t i = 0; i < s.shadowRays.size(); ++i) {
+                if (!s.shadowOccluded[i])
+                    batch.Li.add(s.shadowPixel[i], s.shadowContrib.get(i));
+            }
+        }
+    }
+};
+
+NORI_NAMESPACE_END
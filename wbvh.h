@@ -0,0 +1,217 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/ray.h>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/// Ray data shared by all the node tests of a wide BVH traversal
+struct WideRay {
+    float o[3], rcp[3], mint;
+
+    WideRay(const Ray3f &ray) {
+        for (int i = 0; i < 3; ++i) {
+            o[i] = ray.o[i];
+            rcp[i] = ray.dRcp[i];
+        }
+        mint = ray.mint;
+    }
+};
+
+/**
+ * \brief Node of a 4-wide or 8-wide BVH with compressed child bounds
+ *
+ * The bounds of the children are stored as structure-of-arrays of 8-bit
+ * integers on a grid spanning the node: child bound = origin + q * 2^exponent
+ * per axis, rounded outwards. A BVH4 node fits in one cache line and a BVH8
+ * node in two, and \ref intersect() tests a ray against all the children
+ * with one vector operation per slab.
+ */
+template <int W> struct alignas(W == 4 ? 64 : 128) WideBVHNode {
+    static_assert(W == 4 || W == 8, "WideBVHNode: unsupported width");
+
+    float origin[3];
+    /// Grid spacing per axis, as a power of two
+    int8_t exponent[3];
+    /// Bit \c i is set when child slot \c i is used
+    uint8_t valid;
+    uint8_t qlo[3][W], qhi[3][W];
+    /// Inner child: node index. Leaf child: first triangle block
+    uint32_t child[W];
+    /// Number of triangles of a leaf child (0 for inner children)
+    uint8_t count[W];
+
+    bool isLeaf(int i) const { return count[i] > 0; }
+
+    /// Grid spacing along \c axis
+    float scale(int axis) const {
+        uint32_t bits = (uint32_t) (exponent[axis] + 127) << 23;
+        float result;
+        memcpy(&result, &bits, sizeof(float));
+        return result;
+    }
+
+    /// Dequantized (conservative) bounds of child \c i
+    BoundingBox3f getChildBounds(int i) const {
+        BoundingBox3f bbox;
+        for (int a = 0; a < 3; ++a) {
+            bbox.min[a] = origin[a] + qlo[a][i] * scale(a);
+            bbox.max[a] = origin[a] + qhi[a][i] * scale(a);
+        }
+        return bbox;
+    }
+
+    /// Quantize the bounds of the \c n first children relative to \c parent
+    void setBounds(const BoundingBox3f &parent, const BoundingBox3f *children, int n) {
+        valid = (uint8_t) ((1u << n) - 1);
+        for (int a = 0; a < 3; ++a) {
+            origin[a] = parent.min[a];
+
+            /* Smallest power of two such that 255 steps cover the node */
+            float extent = parent.max[a] - parent.min[a];
+            int e = -126;
+            if (extent > 0)
+                e = std::min(std::max((int) std::ceil(std::log2(extent / 255.f)), -126), 127);
+            exponent[a] = (int8_t) e;
+            while (exponent[a] < 127 && origin[a] + 255 * scale(a) < parent.max[a])
+                exponent[a]++;
+
+            for (int i = 0; i < W; ++i) {
+                if (i >= n) {
+                    qlo[a][i] = qhi[a][i] = 0;
+                    continue;
+                }
+                /* q * 2^e is exact, so the traversal computes the same bounds */
+                float s = scale(a);
+                int lo = (int) std::floor((children[i].min[a] - origin[a]) / s);
+                int hi = (int) std::ceil((children[i].max[a] - origin[a]) / s);
+                lo = std::min(std::max(lo, 0), 255);
+                hi = std::min(std::max(hi, 0), 255);
+                while (lo > 0 && origin[a] + lo * s > children[i].min[a])
+                    lo--;
+                while (hi < 255 && origin[a] + hi * s < children[i].max[a])
+                    hi++;
+                qlo[a][i] = (uint8_t) lo;
+                qhi[a][i] = (uint8_t) hi;
+            }
+        }
+    }
+
+    /**
+     * \brief Intersect a ray against the bounds of all the children
+     *
+     * \param tnear
+     *    Receives the entry distance of each child
+     * \return
+     *    Mask of the children overlapping [ray.mint, maxt]
+     */
+    uint32_t intersect(const WideRay &ray, float maxt, float *tnear) const {
+        uint32_t mask = 0;
+#if defined(__AVX2__)
+        if (W == 8) {
+            mask = intersect8(ray, maxt, tnear);
+            return mask & valid;
+        }
+#endif
+#if defined(__SSE2__)
+        for (int k = 0; k < W; k += 4)
+            mask |= intersect4(ray, maxt, k, tnear) << k;
+#else
+        for (int i = 0; i < W; ++i) {
+            float nearT = ray.mint, farT = maxt;
+            for (int a = 0; a < 3; ++a) {
+                float lo = origin[a] + qlo[a][i] * scale(a);
+                float hi = origin[a] + qhi[a][i] * scale(a);
+                float t0 = (lo - ray.o[a]) * ray.rcp[a], t1 = (hi - ray.o[a]) * ray.rcp[a];
+                nearT = std::max(nearT, std::min(t0, t1));
+                farT = std::min(farT, std::max(t0, t1));
+            }
+            tnear[i] = nearT;
+            mask |= (uint32_t) (nearT <= farT) << i;
+        }
+#endif
+        return mask & valid;
+    }
+
+private:
+#if defined(__SSE2__)
+    /// Convert 4 quantized coordinates to floats
+    static __m128 load4(const uint8_t *q) {
+        int32_t bytes;
+        memcpy(&bytes, q, sizeof(int32_t));
+        __m128i v = _mm_cvtsi32_si128(bytes);
+        v = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+        v = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+        return _mm_cvtepi32_ps(v);
+    }
+
+    /// Slab test of children [k, k+4)
+    uint32_t intersect4(const WideRay &ray, float maxt, int k, float *tnear) const {
+        __m128 nearT = _mm_set1_ps(ray.mint), farT = _mm_set1_ps(maxt);
+        for (int a = 0; a < 3; ++a) {
+            __m128 org = _mm_set1_ps(origin[a]), s = _mm_set1_ps(scale(a));
+            __m128 o = _mm_set1_ps(ray.o[a]), r = _mm_set1_ps(ray.rcp[a]);
+            __m128 lo = _mm_add_ps(org, _mm_mul_ps(load4(&qlo[a][k]), s));
+            __m128 hi = _mm_add_ps(org, _mm_mul_ps(load4(&qhi[a][k]), s));
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), r);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), r);
+            nearT = _mm_max_ps(nearT, _mm_min_ps(t0, t1));
+            farT = _mm_min_ps(farT, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(tnear + k, nearT);
+        return (uint32_t) _mm_movemask_ps(_mm_cmple_ps(nearT, farT));
+    }
+#endif
+
+#if defined(__AVX2__)
+    /// Convert 8 quantized coordinates to floats
+    static __m256 load8(const uint8_t *q) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) q)));
+    }
+
+    /// Slab test of all 8 children
+    uint32_t intersect8(const WideRay &ray, float maxt, float *tnear) const {
+        __m256 nearT = _mm256_set1_ps(ray.mint), farT = _mm256_set1_ps(maxt);
+        for (int a = 0; a < 3; ++a) {
+            __m256 org = _mm256_set1_ps(origin[a]), s = _mm256_set1_ps(scale(a));
+            __m256 o = _mm256_set1_ps(ray.o[a]), r = _mm256_set1_ps(ray.rcp[a]);
+            __m256 lo = _mm256_add_ps(org, _mm256_mul_ps(load8(qlo[a]), s));
+            __m256 hi = _mm256_add_ps(org, _mm256_mul_ps(load8(qhi[a]), s));
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(lo, o), r);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(hi, o), r);
+            nearT = _mm256_max_ps(nearT, _mm256_min_ps(t0, t1));
+            farT = _mm256_min_ps(farT, _mm256_max_ps(t0, t1));
+        }
+        _mm256_storeu_ps(tnear, nearT);
+        return (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(nearT, farT, _CMP_LE_OQ));
+    }
+#endif
+};
+
+static_assert(sizeof(WideBVHNode<4>) == 64, "BVH4 nodes should fit in one cache line");
+static_assert(sizeof(WideBVHNode<8>) == 128, "BVH8 nodes should fit in two cache lines");
+
+NORI_NAMESPACE_END